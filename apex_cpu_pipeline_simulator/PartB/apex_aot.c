@@ -0,0 +1,337 @@
+/*
+ * apex_aot.c
+ * Contains the ahead-of-time translator which turns an APEX program into a C
+ * source file specialized to that program. The generated file is compiled
+ * with the system compiler into a native functional simulator, which is
+ * useful when the same program is run many times on different data.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static int
+get_pc_from_code_memory_index(const int index)
+{
+    return 4000 + index * 4;
+}
+
+/* Returns TRUE if pc is the address of an instruction in code memory */
+static int
+aot_valid_pc(const APEX_CPU *cpu, int pc)
+{
+    return pc >= 4000 && (pc - 4000) % 4 == 0
+           && (pc - 4000) / 4 < cpu->code_memory_size;
+}
+
+/* Emits a jump to pc, which may be outside of code memory */
+static void
+aot_emit_goto(FILE *fp, const APEX_CPU *cpu, int pc)
+{
+    if (aot_valid_pc(cpu, pc))
+    {
+        fprintf(fp, "goto L%d;", pc);
+    }
+    else
+    {
+        fprintf(fp, "{ pc = %d; goto bad_pc; }", pc);
+    }
+}
+
+static void
+aot_emit_alu(FILE *fp, const APEX_Instruction *ins, const char *expr)
+{
+    fprintf(fp, "    R%d = %s; z = (R%d == 0);\n", ins->rd, expr, ins->rd);
+}
+
+static void
+aot_emit_prologue(FILE *fp, const char *filename)
+{
+    int i;
+
+    fprintf(fp, "/*\n * Generated by apex_sim from %s, do not edit.\n", filename);
+    fprintf(fp, " * Usage: <binary> [data_file], data_file has \"address value\" lines\n */\n");
+    fprintf(fp, "#include <stdio.h>\n\n");
+    fprintf(fp, "#define DATA_MEMORY_SIZE %d\n", DATA_MEMORY_SIZE);
+    fprintf(fp, "#define REG_FILE_SIZE %d\n\n", REG_FILE_SIZE);
+    fprintf(fp, "#define CHECK(addr, at) if ((addr) >= DATA_MEMORY_SIZE) "
+                "{ pc = (at); address = (int)(addr); goto bad_address; }\n\n");
+    fprintf(fp, "static int mem[DATA_MEMORY_SIZE];\n\n");
+    fprintf(fp, "int\nmain(int argc, char *argv[])\n{\n");
+    fprintf(fp, "    unsigned int ");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        fprintf(fp, "R%d = 0%s", i, (i == REG_FILE_SIZE - 1) ? ";\n" : ", ");
+    }
+    fprintf(fp, "    unsigned int regs[REG_FILE_SIZE];\n");
+    fprintf(fp, "    unsigned int a;\n");
+    fprintf(fp, "    int z = 0, pc = 4000, address = 0, index, value, i;\n");
+    fprintf(fp, "    long long n = 0;\n");
+    fprintf(fp, "    int status = 0;\n");
+    fprintf(fp, "    FILE *fp;\n\n");
+    fprintf(fp, "    if (argc > 1)\n    {\n");
+    fprintf(fp, "        fp = fopen(argv[1], \"r\");\n");
+    fprintf(fp, "        if (!fp)\n        {\n");
+    fprintf(fp, "            fprintf(stderr, \"APEX_Error: Unable to open %%s\\n\", argv[1]);\n");
+    fprintf(fp, "            return 1;\n        }\n");
+    fprintf(fp, "        while (fscanf(fp, \"%%d %%d\", &index, &value) == 2)\n        {\n");
+    fprintf(fp, "            if (index >= 0 && index < DATA_MEMORY_SIZE)\n            {\n");
+    fprintf(fp, "                mem[index] = value;\n            }\n        }\n");
+    fprintf(fp, "        fclose(fp);\n    }\n\n");
+}
+
+static void
+aot_emit_epilogue(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "bad_pc:\n");
+    fprintf(fp, "    fprintf(stderr, \"APEX_Error: PC %%d outside of code memory\\n\", pc);\n");
+    fprintf(fp, "    status = 1;\n    goto done;\n");
+    fprintf(fp, "bad_address:\n");
+    fprintf(fp, "    fprintf(stderr, \"APEX_Error: Data memory address %%d out of range at pc(%%d)\\n\", address, pc);\n");
+    fprintf(fp, "    status = 1;\n");
+    fprintf(fp, "    n--;\n");
+    fprintf(fp, "done:\n");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        fprintf(fp, "    regs[%d] = R%d;\n", i, i);
+    }
+    fprintf(fp, "    if (status)\n    {\n");
+    fprintf(fp, "        printf(\"APEX_CPU: Functional Simulation Stopped, pc = %%d instructions = %%lld\\n\", pc, n);\n");
+    fprintf(fp, "    }\n    else\n    {\n");
+    fprintf(fp, "        printf(\"APEX_CPU: Functional Simulation Complete, instructions = %%lld\\n\", n);\n");
+    fprintf(fp, "    }\n");
+    fprintf(fp, "    printf(\"\\n=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\\n\");\n");
+    fprintf(fp, "    for (i = 0; i < REG_FILE_SIZE - 1; ++i)\n    {\n");
+    fprintf(fp, "        printf(\"| \\t REG[%%d] \\t | \\t Value = %%d \\t | \\t Status = %%s \\t \\n\", i, (int)regs[i], \"VALID\");\n");
+    fprintf(fp, "    }\n");
+    fprintf(fp, "    printf(\"\\n============== STATE OF DATA MEMORY =============\\n\");\n");
+    fprintf(fp, "    for (i = 0; i < 1000; ++i)\n    {\n");
+    fprintf(fp, "        printf(\"| \\t MEM[%%d] \\t | \\t Data Value = %%d \\t |\\n\", i, mem[i]);\n");
+    fprintf(fp, "    }\n");
+    fprintf(fp, "    return status;\n}\n");
+}
+
+/*
+ * Writes a C program equivalent to the code memory of cpu to fp. Every
+ * instruction gets a label named after its pc, and BZ/BNZ become direct
+ * gotos since their targets are known at translation time.
+ */
+static void
+aot_emit(const APEX_CPU *cpu, const char *filename, FILE *fp)
+{
+    const APEX_Instruction *ins;
+    char expr[64];
+    int i, pc;
+
+    aot_emit_prologue(fp, filename);
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        ins = &cpu->code_memory[i];
+        pc = get_pc_from_code_memory_index(i);
+
+        fprintf(fp, "L%d: /* %s */\n", pc, ins->opcode_str);
+        fprintf(fp, "    n++;\n");
+
+        switch (ins->opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            {
+                const char *op = "+";
+
+                switch (ins->opcode)
+                {
+                    case OPCODE_SUB: op = "-"; break;
+                    case OPCODE_MUL: op = "*"; break;
+                    case OPCODE_AND: op = "&"; break;
+                    case OPCODE_OR: op = "|"; break;
+                    case OPCODE_XOR: op = "^"; break;
+                }
+                snprintf(expr, sizeof(expr), "R%d %s R%d", ins->rs1, op, ins->rs2);
+                aot_emit_alu(fp, ins, expr);
+                break;
+            }
+
+            case OPCODE_ADDL:
+            case OPCODE_SUBL:
+            {
+                snprintf(expr, sizeof(expr), "R%d %s %uu", ins->rs1,
+                         (ins->opcode == OPCODE_ADDL) ? "+" : "-",
+                         (unsigned int)ins->imm);
+                aot_emit_alu(fp, ins, expr);
+                break;
+            }
+
+            case OPCODE_DIV:
+            {
+                /* INT_MIN / -1 overflows the host division */
+                fprintf(fp, "    if (R%d == 0xffffffffu)\n    {\n", ins->rs2);
+                fprintf(fp, "        R%d = 0u - R%d;\n    }\n",
+                        ins->rd, ins->rs1);
+                fprintf(fp, "    else if (R%d != 0)\n    {\n", ins->rs2);
+                fprintf(fp, "        R%d = (unsigned int)((int)R%d / (int)R%d);\n",
+                        ins->rd, ins->rs1, ins->rs2);
+                fprintf(fp, "    }\n    else\n    {\n");
+                fprintf(fp, "        fprintf(stderr, \"Division By Zero Returning Value Zero\\n\");\n");
+                fprintf(fp, "        R%d = 0;\n    }\n", ins->rd);
+                fprintf(fp, "    z = (R%d == 0);\n", ins->rd);
+                break;
+            }
+
+            case OPCODE_MOVC:
+            {
+                snprintf(expr, sizeof(expr), "%uu", (unsigned int)ins->imm);
+                aot_emit_alu(fp, ins, expr);
+                break;
+            }
+
+            case OPCODE_CMP:
+            {
+                fprintf(fp, "    z = (R%d == R%d);\n", ins->rs1, ins->rs2);
+                break;
+            }
+
+            case OPCODE_LOAD:
+            case OPCODE_LDR:
+            {
+                if (ins->opcode == OPCODE_LOAD)
+                {
+                    fprintf(fp, "    a = R%d + %uu;\n", ins->rs1, (unsigned int)ins->imm);
+                }
+                else
+                {
+                    fprintf(fp, "    a = R%d + R%d;\n", ins->rs1, ins->rs2);
+                }
+                fprintf(fp, "    CHECK(a, %d);\n", pc);
+                fprintf(fp, "    R%d = (unsigned int)mem[a];\n", ins->rd);
+                break;
+            }
+
+            case OPCODE_STORE:
+            case OPCODE_STR:
+            {
+                if (ins->opcode == OPCODE_STORE)
+                {
+                    fprintf(fp, "    a = R%d + %uu;\n", ins->rs2, (unsigned int)ins->imm);
+                }
+                else
+                {
+                    fprintf(fp, "    a = R%d + R%d;\n", ins->rs2, ins->rs3);
+                }
+                fprintf(fp, "    CHECK(a, %d);\n", pc);
+                fprintf(fp, "    mem[a] = (int)R%d;\n", ins->rs1);
+                break;
+            }
+
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            {
+                fprintf(fp, "    if (%sz) ", (ins->opcode == OPCODE_BZ) ? "" : "!");
+                aot_emit_goto(fp, cpu, pc + ins->imm);
+                fprintf(fp, "\n");
+                break;
+            }
+
+            case OPCODE_HALT:
+            {
+                fprintf(fp, "    pc = %d;\n    goto done;\n", pc);
+                break;
+            }
+
+            case OPCODE_NOP:
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    /* Falling off the end of code memory */
+    fprintf(fp, "    pc = %d;\n    goto bad_pc;\n",
+            get_pc_from_code_memory_index(cpu->code_memory_size));
+    aot_emit_epilogue(fp);
+}
+
+/*
+ * Returns TRUE if path can be put between double quotes in a shell command
+ * and inside the block comment of the generated source
+ */
+static int
+aot_path_quotable(const char *path)
+{
+    return strpbrk(path, "\"$`\\") == NULL && strstr(path, "*/") == NULL;
+}
+
+/*
+ * Translates the program loaded into cpu to <filename>.aot.c, compiles it to
+ * <filename>.aot with $CC (default cc) and runs it on data_file, if given.
+ * Returns the exit status of the last command run, which is non zero if the
+ * program stopped on a bad pc or data address.
+ */
+int
+APEX_cpu_aot(APEX_CPU *cpu, const char *filename, const char *data_file)
+{
+    char source[1024], binary[1024], command[4096];
+    const char *cc = getenv("CC");
+    FILE *fp;
+    int ret;
+
+    if (!aot_path_quotable(filename)
+        || (data_file && !aot_path_quotable(data_file)))
+    {
+        fprintf(stderr, "APEX_Error: aot does not support paths containing \", $, `, \\ or */\n");
+        return 1;
+    }
+
+    snprintf(source, sizeof(source), "%s.aot.c", filename);
+    snprintf(binary, sizeof(binary), "%s.aot", filename);
+
+    fp = fopen(source, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n", source);
+        return 1;
+    }
+    aot_emit(cpu, filename, fp);
+    fclose(fp);
+
+    if (!cc || !*cc)
+    {
+        cc = "cc";
+    }
+    snprintf(command, sizeof(command), "%s -O2 -w -o \"%s\" \"%s\"", cc, binary,
+             source);
+    fprintf(stderr, "APEX_AOT: %s\n", command);
+    ret = system(command);
+    if (ret != 0)
+    {
+        fprintf(stderr, "APEX_Error: Compiling %s failed\n", source);
+        return ret;
+    }
+
+    if (strchr(binary, '/'))
+    {
+        snprintf(command, sizeof(command), "\"%s\"", binary);
+    }
+    else
+    {
+        snprintf(command, sizeof(command), "\"./%s\"", binary);
+    }
+    if (data_file)
+    {
+        strncat(command, " \"", sizeof(command) - strlen(command) - 1);
+        strncat(command, data_file, sizeof(command) - strlen(command) - 1);
+        strncat(command, "\"", sizeof(command) - strlen(command) - 1);
+    }
+    fflush(stdout);
+    return system(command);
+}
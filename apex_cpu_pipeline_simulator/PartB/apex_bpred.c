@@ -0,0 +1,437 @@
+/*
+ * apex_bpred.c
+ * Contains the branch predictor bank. The pipeline has no predictor: fetch
+ * goes on sequentially and every taken BZ/BNZ flushes the two younger
+ * instructions when it resolves in execute. In branch profiling mode every
+ * outcome resolved in execute is fed to a bank of predictors of several
+ * kinds and sizes at once, so one run compares them all.
+ *
+ * The target of a branch is pc + imm, known in fetch, so a predictor there
+ * would only lose the flush cycles on a misprediction instead of on every
+ * taken branch. The cycles saved are projected from that.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Cycles lost by a flush: the squashed decode and the skipped fetch */
+#define BPRED_FLUSH_PENALTY 2
+
+/* Kinds of predictors */
+#define BPRED_BTFN 0x0             /* Backward taken, forward not taken */
+#define BPRED_BIMODAL 0x1          /* 2 bit counters by pc */
+#define BPRED_GSHARE 0x2           /* 2 bit counters by pc xor global history */
+#define BPRED_LOCAL 0x3            /* 2 bit counters by the history of the branch */
+#define BPRED_TAGE 0x4             /* Bimodal and tagged tables of longer histories */
+
+/* Tagged tables of a TAGE predictor, and the history length of the first */
+#define TAGE_TABLES 4
+#define TAGE_MIN_HISTORY 4
+#define TAGE_TAG_BITS 8
+
+/* Entry of a tagged TAGE table */
+typedef struct APEX_Tage_Entry
+{
+    unsigned char tag;
+    signed char counter;           /* 3 bits, taken if >= 0 */
+    unsigned char useful;          /* 2 bits */
+} APEX_Tage_Entry;
+
+/* A predictor of the bank */
+typedef struct APEX_Predictor
+{
+    int kind;
+    int log_size;                  /* log2 of the counters or entries per table */
+    int history_bits;              /* Of the local histories */
+    char name[32];
+    long long bits;                /* Storage */
+    unsigned char *counters;       /* 2 bit counters, taken if >= 2 */
+    unsigned int *histories;       /* Local histories */
+    APEX_Tage_Entry *tagged[TAGE_TABLES];
+    long long mispredicts;
+} APEX_Predictor;
+
+/* Predictor configurations of the bank */
+static const struct
+{
+    int kind;
+    int log_size;
+    int history_bits;
+} bpred_configs[] = {
+    {BPRED_BTFN, 0, 0},
+    {BPRED_BIMODAL, 4, 0}, {BPRED_BIMODAL, 6, 0}, {BPRED_BIMODAL, 8, 0},
+    {BPRED_BIMODAL, 10, 0},
+    {BPRED_GSHARE, 6, 0}, {BPRED_GSHARE, 8, 0}, {BPRED_GSHARE, 10, 0},
+    {BPRED_GSHARE, 12, 0},
+    {BPRED_LOCAL, 4, 6}, {BPRED_LOCAL, 6, 8}, {BPRED_LOCAL, 8, 10},
+    {BPRED_TAGE, 6, 0}, {BPRED_TAGE, 8, 0}, {BPRED_TAGE, 10, 0},
+};
+
+#define NUM_PREDICTORS (int)(sizeof(bpred_configs) / sizeof(bpred_configs[0]))
+
+/* Predictor bank of a run */
+typedef struct APEX_Bpred
+{
+    long long branches;
+    long long taken;
+    unsigned long long history;    /* Global, last outcome in bit 0 */
+    int start_clock;
+    APEX_Predictor predictors[NUM_PREDICTORS];
+} APEX_Bpred;
+
+/* Returns the branch index of pc, instructions being 4 bytes apart */
+static unsigned int
+bpred_pc(int pc)
+{
+    return (unsigned int)pc >> 2;
+}
+
+/* Moves 2 bit counter towards taken */
+static void
+bpred_train(unsigned char *counter, int taken)
+{
+    if (taken && *counter < 3)
+    {
+        (*counter)++;
+    }
+    else if (!taken && *counter > 0)
+    {
+        (*counter)--;
+    }
+}
+
+/* Returns the last length bits of history folded to bits bits */
+static unsigned int
+tage_fold(unsigned long long history, int length, int bits)
+{
+    unsigned int folded = 0;
+
+    history &= length < 64 ? (1ULL << length) - 1 : ~0ULL;
+    while (history)
+    {
+        folded ^= history & ((1U << bits) - 1);
+        history >>= bits;
+    }
+    return folded;
+}
+
+/* Returns the index of pc in TAGE table t */
+static unsigned int
+tage_index(const APEX_Predictor *p, unsigned long long history, int pc, int t)
+{
+    return (bpred_pc(pc) ^ (bpred_pc(pc) >> p->log_size)
+            ^ tage_fold(history, TAGE_MIN_HISTORY << t, p->log_size))
+           & ((1U << p->log_size) - 1);
+}
+
+/* Returns the tag of pc in TAGE table t */
+static unsigned char
+tage_tag(unsigned long long history, int pc, int t)
+{
+    return (bpred_pc(pc) ^ tage_fold(history, TAGE_MIN_HISTORY << t,
+                                     TAGE_TAG_BITS)
+            ^ (t << 5)) & ((1U << TAGE_TAG_BITS) - 1);
+}
+
+/*
+ * Predicts the branch at pc with TAGE predictor p and trains it with
+ * outcome taken. The longest history table with a matching tag provides the
+ * prediction, the bimodal table if none does. A misprediction allocates an
+ * entry in a longer table whose entry is not useful, or ages them all.
+ * Returns the prediction.
+ */
+static int
+tage_predict_train(APEX_Predictor *p, unsigned long long history, int pc,
+                   int taken)
+{
+    unsigned int index[TAGE_TABLES];
+    unsigned char tag[TAGE_TABLES];
+    unsigned char *base = &p->counters[bpred_pc(pc) & ((1U << p->log_size) - 1)];
+    APEX_Tage_Entry *provider = NULL;
+    APEX_Tage_Entry *entry;
+    int provider_table = -1;
+    int alternate = *base >= 2;
+    int prediction;
+    int allocated = FALSE;
+    int t;
+
+    for (t = 0; t < TAGE_TABLES; ++t)
+    {
+        index[t] = tage_index(p, history, pc, t);
+        tag[t] = tage_tag(history, pc, t);
+        if (p->tagged[t][index[t]].tag == tag[t])
+        {
+            if (provider)
+            {
+                alternate = provider->counter >= 0;
+            }
+            provider = &p->tagged[t][index[t]];
+            provider_table = t;
+        }
+    }
+    prediction = provider ? provider->counter >= 0 : alternate;
+
+    if (provider)
+    {
+        if (taken && provider->counter < 3)
+        {
+            provider->counter++;
+        }
+        else if (!taken && provider->counter > -4)
+        {
+            provider->counter--;
+        }
+        if (prediction != alternate)
+        {
+            if (prediction == taken && provider->useful < 3)
+            {
+                provider->useful++;
+            }
+            else if (prediction != taken && provider->useful > 0)
+            {
+                provider->useful--;
+            }
+        }
+    }
+    else
+    {
+        bpred_train(base, taken);
+    }
+
+    if (prediction != taken)
+    {
+        for (t = provider_table + 1; t < TAGE_TABLES && !allocated; ++t)
+        {
+            entry = &p->tagged[t][index[t]];
+            if (entry->useful == 0)
+            {
+                entry->tag = tag[t];
+                entry->counter = taken ? 0 : -1;
+                allocated = TRUE;
+            }
+        }
+        for (t = provider_table + 1; t < TAGE_TABLES && !allocated; ++t)
+        {
+            p->tagged[t][index[t]].useful--;
+        }
+    }
+    return prediction;
+}
+
+/*
+ * Predicts the branch at pc, with offset imm, with predictor p and trains it
+ * with outcome taken. Returns the prediction.
+ */
+static int
+bpred_predict_train(APEX_Predictor *p, unsigned long long history, int pc,
+                    int imm, int taken)
+{
+    unsigned int mask = (1U << p->log_size) - 1;
+    unsigned int *local;
+    unsigned char *counter;
+    int prediction;
+
+    switch (p->kind)
+    {
+        case BPRED_BTFN:
+            return imm < 0;
+
+        case BPRED_BIMODAL:
+            counter = &p->counters[bpred_pc(pc) & mask];
+            break;
+
+        case BPRED_GSHARE:
+            counter = &p->counters[(bpred_pc(pc) ^ history) & mask];
+            break;
+
+        case BPRED_LOCAL:
+            local = &p->histories[bpred_pc(pc) & mask];
+            counter = &p->counters[*local];
+            *local = ((*local << 1) | taken) & ((1U << p->history_bits) - 1);
+            break;
+
+        case BPRED_TAGE:
+        default:
+            return tage_predict_train(p, history, pc, taken);
+    }
+
+    prediction = *counter >= 2;
+    bpred_train(counter, taken);
+    return prediction;
+}
+
+/* Frees the predictor bank of cpu */
+void
+APEX_bpred_free(APEX_CPU *cpu)
+{
+    APEX_Predictor *p;
+    int i, t;
+
+    if (!cpu->bpred)
+    {
+        return;
+    }
+
+    for (i = 0; i < NUM_PREDICTORS; ++i)
+    {
+        p = &cpu->bpred->predictors[i];
+        free(p->counters);
+        free(p->histories);
+        for (t = 0; t < TAGE_TABLES; ++t)
+        {
+            free(p->tagged[t]);
+        }
+    }
+    free(cpu->bpred);
+    cpu->bpred = NULL;
+}
+
+/* Starts the predictor bank of cpu, returns -1 if it can't be allocated */
+int
+APEX_bpred_enable(APEX_CPU *cpu)
+{
+    APEX_Predictor *p;
+    int counters;
+    int i, t;
+
+    if (cpu->bpred)
+    {
+        return 0;
+    }
+
+    cpu->bpred = calloc(1, sizeof(APEX_Bpred));
+    if (!cpu->bpred)
+    {
+        return -1;
+    }
+    cpu->bpred->start_clock = cpu->clock;
+
+    for (i = 0; i < NUM_PREDICTORS; ++i)
+    {
+        p = &cpu->bpred->predictors[i];
+        p->kind = bpred_configs[i].kind;
+        p->log_size = bpred_configs[i].log_size;
+        p->history_bits = bpred_configs[i].history_bits;
+
+        /* Counters start weakly not taken */
+        counters = 1 << (p->kind == BPRED_LOCAL ? p->history_bits : p->log_size);
+        p->counters = malloc(counters);
+        if (!p->counters)
+        {
+            APEX_bpred_free(cpu);
+            return -1;
+        }
+        for (t = 0; t < counters; ++t)
+        {
+            p->counters[t] = 1;
+        }
+
+        switch (p->kind)
+        {
+            case BPRED_BTFN:
+                snprintf(p->name, sizeof(p->name), "btfn");
+                break;
+
+            case BPRED_BIMODAL:
+                snprintf(p->name, sizeof(p->name), "bimodal-%d", counters);
+                p->bits = 2LL * counters;
+                break;
+
+            case BPRED_GSHARE:
+                snprintf(p->name, sizeof(p->name), "gshare-%d", counters);
+                p->bits = 2LL * counters;
+                break;
+
+            case BPRED_LOCAL:
+                snprintf(p->name, sizeof(p->name), "local-%dx%d",
+                         1 << p->log_size, p->history_bits);
+                p->histories = calloc(1 << p->log_size, sizeof(unsigned int));
+                p->bits = (long long)p->history_bits * (1 << p->log_size)
+                          + 2LL * counters;
+                if (!p->histories)
+                {
+                    APEX_bpred_free(cpu);
+                    return -1;
+                }
+                break;
+
+            case BPRED_TAGE:
+                snprintf(p->name, sizeof(p->name), "tage-%dx%d",
+                         TAGE_TABLES + 1, counters);
+                p->bits = 2LL * counters
+                          + (long long)TAGE_TABLES * counters
+                            * (TAGE_TAG_BITS + 3 + 2);
+                for (t = 0; t < TAGE_TABLES; ++t)
+                {
+                    p->tagged[t] = calloc(counters, sizeof(APEX_Tage_Entry));
+                    if (!p->tagged[t])
+                    {
+                        APEX_bpred_free(cpu);
+                        return -1;
+                    }
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Feeds the outcome taken of the branch at pc, with offset imm, to the bank */
+void
+APEX_bpred_branch(APEX_CPU *cpu, int pc, int imm, int taken)
+{
+    APEX_Bpred *bpred = cpu->bpred;
+    APEX_Predictor *p;
+    int i;
+
+    bpred->branches++;
+    bpred->taken += taken;
+    for (i = 0; i < NUM_PREDICTORS; ++i)
+    {
+        p = &bpred->predictors[i];
+        if (bpred_predict_train(p, bpred->history, pc, imm, taken) != taken)
+        {
+            p->mispredicts++;
+        }
+    }
+    bpred->history = (bpred->history << 1) | taken;
+}
+
+/*
+ * Prints the accuracy of every predictor of the bank, and the cycles the run
+ * would have saved with it: a flush on every misprediction instead of on
+ * every taken branch.
+ */
+void
+APEX_bpred_print(const APEX_CPU *cpu)
+{
+    const APEX_Bpred *bpred = cpu->bpred;
+    const APEX_Predictor *p;
+    int cycles;
+    long long saved;
+    int i;
+
+    if (!bpred)
+    {
+        return;
+    }
+
+    cycles = cpu->clock - bpred->start_clock;
+    printf("APEX_BPRED: %lld branches, %lld taken, %d cycles, %d cycles per flush\n",
+           bpred->branches, bpred->taken, cycles, BPRED_FLUSH_PENALTY);
+    printf("APEX_BPRED: %-14s %8s %12s %9s %12s %10s\n", "predictor", "bits",
+           "mispredicts", "accuracy", "cycles_saved", "speedup");
+    for (i = 0; i < NUM_PREDICTORS; ++i)
+    {
+        p = &bpred->predictors[i];
+        saved = BPRED_FLUSH_PENALTY * (bpred->taken - p->mispredicts);
+        printf("APEX_BPRED: %-14s %8lld %12lld %8.2f%% %12lld %9.3fx\n",
+               p->name, p->bits, p->mispredicts,
+               bpred->branches
+               ? 100.0 * (bpred->branches - p->mispredicts) / bpred->branches
+               : 100.0,
+               saved, cycles > saved ? (double)cycles / (cycles - saved) : 1.0);
+    }
+}
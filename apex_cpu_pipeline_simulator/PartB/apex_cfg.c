@@ -0,0 +1,297 @@
+/*
+ * apex_cfg.c
+ * Contains basic block discovery for code memory. The control flow graph is
+ * built once at load time: BZ/BNZ targets are pc relative immediates, so all
+ * of them are known and can be validated before the program runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cfg.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static int
+get_pc_from_code_memory_index(const int index)
+{
+    return 4000 + index * 4;
+}
+
+static int
+cfg_is_branch(const APEX_Instruction *ins)
+{
+    return ins->opcode == OPCODE_BZ || ins->opcode == OPCODE_BNZ;
+}
+
+/* Marks blocks which are the target of a back edge, found by a depth first
+ * search from the entry block. Returns -1 if out of memory. */
+static int
+cfg_find_loop_headers(APEX_CFG *cfg)
+{
+    int *stack, *next_succ;
+    char *state;                   /* 0 unvisited, 1 on stack, 2 done */
+    int top = 0, b, s;
+
+    stack = malloc(cfg->num_blocks * sizeof(int));
+    next_succ = calloc(cfg->num_blocks, sizeof(int));
+    state = calloc(cfg->num_blocks, 1);
+    if (!stack || !next_succ || !state)
+    {
+        free(stack);
+        free(next_succ);
+        free(state);
+        return -1;
+    }
+
+    stack[top++] = 0;
+    state[0] = 1;
+    while (top > 0)
+    {
+        b = stack[top - 1];
+        if (next_succ[b] == 2)
+        {
+            state[b] = 2;
+            top--;
+            continue;
+        }
+
+        s = cfg->blocks[b].succ[next_succ[b]++];
+        if (s < 0)
+        {
+            continue;
+        }
+
+        if (state[s] == 1)
+        {
+            if (!cfg->blocks[s].loop_header)
+            {
+                cfg->blocks[s].loop_header = TRUE;
+                cfg->num_loop_headers++;
+            }
+        }
+        else if (state[s] == 0)
+        {
+            state[s] = 1;
+            stack[top++] = s;
+        }
+    }
+
+    free(stack);
+    free(next_succ);
+    free(state);
+    return 0;
+}
+
+/*
+ * Builds the control flow graph of code memory. Returns NULL if a BZ/BNZ
+ * targets a pc outside of code memory or if out of memory.
+ */
+APEX_CFG *
+APEX_cfg_build(const APEX_Instruction *code_memory, int size)
+{
+    APEX_CFG *cfg;
+    char *leader;
+    int i, b, target_pc, valid = TRUE;
+
+    cfg = calloc(1, sizeof(APEX_CFG));
+    leader = calloc(size + 1, 1);
+    if (!cfg || !leader)
+    {
+        free(cfg);
+        free(leader);
+        return NULL;
+    }
+    cfg->block_of = malloc((size ? size : 1) * sizeof(int));
+    cfg->target = malloc((size ? size : 1) * sizeof(int));
+    cfg->blocks = malloc((size ? size : 1) * sizeof(APEX_Block));
+    if (!cfg->block_of || !cfg->target || !cfg->blocks)
+    {
+        free(leader);
+        APEX_cfg_free(cfg);
+        return NULL;
+    }
+
+    /* Find leaders and validate branch targets */
+    leader[0] = TRUE;
+    for (i = 0; i < size; ++i)
+    {
+        cfg->target[i] = -1;
+
+        if (cfg_is_branch(&code_memory[i]))
+        {
+            target_pc = get_pc_from_code_memory_index(i) + code_memory[i].imm;
+            if (code_memory[i].imm % 4 != 0 || target_pc < 4000
+                || (target_pc - 4000) / 4 >= size)
+            {
+                fprintf(stderr, "APEX_Error: %s at pc(%d) branches to invalid pc %d\n",
+                        code_memory[i].opcode_str,
+                        get_pc_from_code_memory_index(i), target_pc);
+                valid = FALSE;
+                continue;
+            }
+            cfg->target[i] = (target_pc - 4000) / 4;
+            leader[cfg->target[i]] = TRUE;
+            leader[i + 1] = TRUE;
+        }
+        else if (code_memory[i].opcode == OPCODE_HALT)
+        {
+            leader[i + 1] = TRUE;
+        }
+    }
+
+    if (!valid)
+    {
+        free(leader);
+        APEX_cfg_free(cfg);
+        return NULL;
+    }
+
+    /* Form blocks */
+    for (i = 0; i < size; ++i)
+    {
+        if (leader[i])
+        {
+            b = cfg->num_blocks++;
+            cfg->blocks[b].start = i;
+            cfg->blocks[b].loop_header = FALSE;
+        }
+        cfg->blocks[cfg->num_blocks - 1].end = i;
+        cfg->block_of[i] = cfg->num_blocks - 1;
+    }
+
+    /* Connect successors */
+    for (b = 0; b < cfg->num_blocks; ++b)
+    {
+        const APEX_Instruction *last = &code_memory[cfg->blocks[b].end];
+
+        cfg->blocks[b].succ[CFG_FALL_THROUGH] = -1;
+        cfg->blocks[b].succ[CFG_TAKEN] = -1;
+
+        if (last->opcode != OPCODE_HALT && cfg->blocks[b].end + 1 < size)
+        {
+            cfg->blocks[b].succ[CFG_FALL_THROUGH] = b + 1;
+        }
+
+        if (cfg_is_branch(last))
+        {
+            cfg->blocks[b].succ[CFG_TAKEN]
+                = cfg->block_of[cfg->target[cfg->blocks[b].end]];
+        }
+    }
+
+    free(leader);
+    if (cfg->num_blocks > 0 && cfg_find_loop_headers(cfg) < 0)
+    {
+        APEX_cfg_free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+void
+APEX_cfg_free(APEX_CFG *cfg)
+{
+    if (!cfg)
+    {
+        return;
+    }
+
+    free(cfg->blocks);
+    free(cfg->block_of);
+    free(cfg->target);
+    free(cfg);
+}
+
+static void
+cfg_export_dot(const APEX_CFG *cfg, const APEX_Instruction *code_memory,
+               FILE *fp)
+{
+    const APEX_Block *block;
+    int b, i;
+
+    fprintf(fp, "digraph apex_cfg {\n");
+    fprintf(fp, "    node [shape=box fontname=\"monospace\"];\n");
+    for (b = 0; b < cfg->num_blocks; ++b)
+    {
+        block = &cfg->blocks[b];
+        fprintf(fp, "    B%d [label=\"B%d%s\\l", b, b,
+                block->loop_header ? " (loop header)" : "");
+        for (i = block->start; i <= block->end; ++i)
+        {
+            fprintf(fp, "%d: %s\\l", get_pc_from_code_memory_index(i),
+                    code_memory[i].opcode_str);
+        }
+        fprintf(fp, "\"%s];\n", block->loop_header ? " style=bold" : "");
+    }
+
+    for (b = 0; b < cfg->num_blocks; ++b)
+    {
+        block = &cfg->blocks[b];
+        if (block->succ[CFG_FALL_THROUGH] >= 0)
+        {
+            fprintf(fp, "    B%d -> B%d;\n", b, block->succ[CFG_FALL_THROUGH]);
+        }
+        if (block->succ[CFG_TAKEN] >= 0)
+        {
+            fprintf(fp, "    B%d -> B%d [label=\"taken\"];\n", b,
+                    block->succ[CFG_TAKEN]);
+        }
+    }
+    fprintf(fp, "}\n");
+}
+
+static void
+cfg_export_json(const APEX_CFG *cfg, FILE *fp)
+{
+    const APEX_Block *block;
+    int b;
+
+    fprintf(fp, "{\n  \"num_blocks\": %d,\n  \"num_loop_headers\": %d,\n",
+            cfg->num_blocks, cfg->num_loop_headers);
+    fprintf(fp, "  \"blocks\": [\n");
+    for (b = 0; b < cfg->num_blocks; ++b)
+    {
+        block = &cfg->blocks[b];
+        fprintf(fp, "    {\"id\": %d, \"start_pc\": %d, \"end_pc\": %d, "
+                "\"num_insns\": %d, \"loop_header\": %s, "
+                "\"fall_through\": %d, \"taken\": %d}%s\n",
+                b, get_pc_from_code_memory_index(block->start),
+                get_pc_from_code_memory_index(block->end),
+                block->end - block->start + 1,
+                block->loop_header ? "true" : "false",
+                block->succ[CFG_FALL_THROUGH], block->succ[CFG_TAKEN],
+                (b == cfg->num_blocks - 1) ? "" : ",");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+/*
+ * Writes the control flow graph to filename, as Graphviz DOT if the name
+ * ends in ".dot" and as JSON otherwise. Returns 0 on success.
+ */
+int
+APEX_cfg_export(const APEX_CFG *cfg, const APEX_Instruction *code_memory,
+                const char *filename)
+{
+    size_t len = strlen(filename);
+    FILE *fp;
+
+    fp = fopen(filename, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    if (len > 4 && strcmp(filename + len - 4, ".dot") == 0)
+    {
+        cfg_export_dot(cfg, code_memory, fp);
+    }
+    else
+    {
+        cfg_export_json(cfg, fp);
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * apex_cfg.h
+ * Contains declarations of the control flow graph built from code memory
+ */
+#ifndef _APEX_CFG_H_
+#define _APEX_CFG_H_
+
+#include <stdio.h>
+
+#include "apex_cpu.h"
+
+/* Successor slots of a basic block */
+#define CFG_FALL_THROUGH 0
+#define CFG_TAKEN 1
+
+/* Basic block of code memory */
+typedef struct APEX_Block
+{
+    int start;                     /* Code memory index of first instruction */
+    int end;                       /* Code memory index of last instruction */
+    int succ[2];                   /* Successor block ids, -1 if none */
+    int loop_header;               /* Target of a back edge */
+} APEX_Block;
+
+/* Control flow graph of code memory */
+typedef struct APEX_CFG
+{
+    int num_blocks;
+    APEX_Block *blocks;
+    int *block_of;                 /* Block id of every code memory index */
+    int *target;                   /* Branch target index, -1 if not a branch */
+    int num_loop_headers;
+} APEX_CFG;
+
+APEX_CFG *APEX_cfg_build(const APEX_Instruction *code_memory, int size);
+void APEX_cfg_free(APEX_CFG *cfg);
+int APEX_cfg_export(const APEX_CFG *cfg, const APEX_Instruction *code_memory,
+                    const char *filename);
+#endif
@@ -0,0 +1,178 @@
+/*
+ * apex_chrome.c
+ * Contains the Chrome trace event export of what the simulator does on the
+ * host, loadable in Perfetto or chrome://tracing. Program load, init,
+ * checkpoints, output and chunks of simulated cycles are written as complete
+ * ("X") events on the thread that ran them, and every thread gets a name.
+ *
+ * Timestamps are the host monotonic clock and the process id is the real
+ * one, so the traces of concurrent jobs on one machine line up when they are
+ * opened together. The trace is process wide and may be written from the
+ * sampling worker threads, so writes are serialized by a lock.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static FILE *chrome_fp;
+static pthread_mutex_t chrome_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int chrome_next_tid = 1;
+static _Thread_local int chrome_tid;
+
+/* Returns the host monotonic time in ns */
+static long long
+chrome_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Returns the trace thread id of the calling thread */
+static int
+chrome_thread(void)
+{
+    if (!chrome_tid)
+    {
+        chrome_tid = atomic_fetch_add(&chrome_next_tid, 1);
+    }
+    return chrome_tid;
+}
+
+/* Writes text to the trace as the contents of a JSON string */
+static void
+chrome_put_string(const char *text)
+{
+    const unsigned char *c;
+
+    for (c = (const unsigned char *)text; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(chrome_fp, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            fprintf(chrome_fp, "\\u%04x", *c);
+        }
+        else
+        {
+            fputc(*c, chrome_fp);
+        }
+    }
+}
+
+/*
+ * Starts writing the trace to filename, with the process named after
+ * program. Returns 0 on success.
+ */
+int
+APEX_chrome_open(const char *filename, const char *program)
+{
+    chrome_fp = fopen(filename, "w");
+    if (!chrome_fp)
+    {
+        return -1;
+    }
+
+    fprintf(chrome_fp, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"apex_sim ", (int)getpid());
+    chrome_put_string(program);
+    fprintf(chrome_fp, "\"}}");
+    APEX_chrome_thread_name("main");
+    return 0;
+}
+
+/* Finishes the trace, returns 0 on success */
+int
+APEX_chrome_close(void)
+{
+    int ret;
+
+    if (!chrome_fp)
+    {
+        return 0;
+    }
+
+    fprintf(chrome_fp, "\n]\n");
+    ret = fclose(chrome_fp) == 0 ? 0 : -1;
+    chrome_fp = NULL;
+    return ret;
+}
+
+/* Names the calling thread in the trace */
+void
+APEX_chrome_thread_name(const char *name)
+{
+    if (!chrome_fp)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&chrome_lock);
+    fprintf(chrome_fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":\"", (int)getpid(),
+            chrome_thread());
+    chrome_put_string(name);
+    fprintf(chrome_fp, "\"}}");
+    pthread_mutex_unlock(&chrome_lock);
+}
+
+/* Returns the start time of a span, 0 if no trace is being written */
+long long
+APEX_chrome_begin(void)
+{
+    return chrome_fp ? chrome_now() : 0;
+}
+
+/*
+ * Writes the span called name of category, from start (returned by
+ * APEX_chrome_begin) until now, on the calling thread. args is "" or the
+ * members of the JSON args object, with any strings in them escaped.
+ */
+void
+APEX_chrome_end(const char *name, const char *category, long long start,
+                const char *args)
+{
+    long long end;
+
+    if (!chrome_fp || !start)
+    {
+        return;
+    }
+
+    end = chrome_now();
+    pthread_mutex_lock(&chrome_lock);
+    fprintf(chrome_fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{%s}}",
+            name, category, start / 1000.0, (end - start) / 1000.0,
+            (int)getpid(), chrome_thread(), args);
+    pthread_mutex_unlock(&chrome_lock);
+}
+
+/*
+ * Ends the current chunk of simulated cycles of cpu and starts the next one.
+ * Called by the pipeline every CHROME_CHUNK_CYCLES cycles and at the end of a
+ * run, while cpu->chrome_chunk_start is set.
+ */
+void
+APEX_chrome_chunk(APEX_CPU *cpu)
+{
+    char args[64];
+
+    if (cpu->clock > cpu->chrome_chunk_clock)
+    {
+        snprintf(args, sizeof(args), "\"first_cycle\":%d,\"cycles\":%d",
+                 cpu->chrome_chunk_clock + 1,
+                 cpu->clock - cpu->chrome_chunk_clock);
+        APEX_chrome_end("simulate", "simulate", cpu->chrome_chunk_start, args);
+    }
+    cpu->chrome_chunk_start = APEX_chrome_begin();
+    cpu->chrome_chunk_clock = cpu->clock;
+}
@@ -0,0 +1,327 @@
+/*
+ * apex_ckpt.c
+ * Contains checkpoint save and restore of the APEX cpu. A checkpoint holds
+ * everything needed to continue a pipeline simulation: architectural state,
+ * the clock, the performance counters, the pipeline latches and the non zero
+ * words of data memory.
+ * Code memory is not stored, a checksum ties the checkpoint to its program.
+ *
+ * Checkpoints are written in host byte order, as 32 bit words apart from the
+ * 64 bit counters, and are read back through mmap.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define CKPT_MAGIC "APEXCKPT"
+#define CKPT_VERSION 2
+#define CKPT_OPCODE_LEN 128
+
+/* A pipeline latch */
+typedef struct APEX_Ckpt_Stage
+{
+    int32_t pc;
+    int32_t opcode;
+    int32_t rs1;
+    int32_t rs2;
+    int32_t rs3;
+    int32_t rd;
+    int32_t imm;
+    int32_t rs1_value;
+    int32_t rs2_value;
+    int32_t rs3_value;
+    int32_t result_buffer;
+    int32_t memory_address;
+    int32_t has_insn;
+    int32_t stalled;
+    char opcode_str[CKPT_OPCODE_LEN];
+} APEX_Ckpt_Stage;
+
+/* Start of the file, followed by num_data_words (address, value) pairs */
+typedef struct APEX_Ckpt_Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t code_memory_size;
+    uint32_t code_checksum;
+    int32_t pc;
+    int32_t clock;
+    int32_t insn_completed;
+    int32_t zero_flag;
+    int32_t fetch_from_next_cycle;
+    int32_t regs[REG_FILE_SIZE];
+    int32_t valid_regs[REG_FILE_SIZE];
+    APEX_Ckpt_Stage stages[5];
+    APEX_Stats stats;              /* So the CPI stack adds up to the clock */
+    uint32_t num_data_words;
+} APEX_Ckpt_Header;
+
+/* FNV-1a over the fields of code memory that affect execution */
+static uint32_t
+ckpt_code_checksum(const APEX_CPU *cpu)
+{
+    uint32_t hash = 2166136261u;
+    int32_t fields[6];
+    int i, j;
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        fields[0] = cpu->code_memory[i].opcode;
+        fields[1] = cpu->code_memory[i].rd;
+        fields[2] = cpu->code_memory[i].rs1;
+        fields[3] = cpu->code_memory[i].rs2;
+        fields[4] = cpu->code_memory[i].rs3;
+        fields[5] = cpu->code_memory[i].imm;
+        for (j = 0; j < (int)sizeof(fields); ++j)
+        {
+            hash ^= ((const unsigned char *)fields)[j];
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+static CPU_Stage *
+ckpt_stage(APEX_CPU *cpu, int i)
+{
+    CPU_Stage *stages[5];
+
+    stages[0] = &cpu->fetch;
+    stages[1] = &cpu->decode;
+    stages[2] = &cpu->execute;
+    stages[3] = &cpu->memory;
+    stages[4] = &cpu->writeback;
+    return stages[i];
+}
+
+static void
+ckpt_save_stage(APEX_Ckpt_Stage *out, const CPU_Stage *stage)
+{
+    out->pc = stage->pc;
+    out->opcode = stage->opcode;
+    out->rs1 = stage->rs1;
+    out->rs2 = stage->rs2;
+    out->rs3 = stage->rs3;
+    out->rd = stage->rd;
+    out->imm = stage->imm;
+    out->rs1_value = stage->rs1_value;
+    out->rs2_value = stage->rs2_value;
+    out->rs3_value = stage->rs3_value;
+    out->result_buffer = stage->result_buffer;
+    out->memory_address = stage->memory_address;
+    out->has_insn = stage->has_insn;
+    out->stalled = stage->stalled;
+    strncpy(out->opcode_str, stage->opcode_str, CKPT_OPCODE_LEN - 1);
+}
+
+static void
+ckpt_restore_stage(CPU_Stage *stage, const APEX_Ckpt_Stage *in)
+{
+    stage->pc = in->pc;
+    stage->opcode = in->opcode;
+    stage->rs1 = in->rs1;
+    stage->rs2 = in->rs2;
+    stage->rs3 = in->rs3;
+    stage->rd = in->rd;
+    stage->imm = in->imm;
+    stage->rs1_value = in->rs1_value;
+    stage->rs2_value = in->rs2_value;
+    stage->rs3_value = in->rs3_value;
+    stage->result_buffer = in->result_buffer;
+    stage->memory_address = in->memory_address;
+    stage->has_insn = in->has_insn;
+    stage->stalled = in->stalled;
+    memcpy(stage->opcode_str, in->opcode_str, CKPT_OPCODE_LEN);
+    stage->opcode_str[sizeof(stage->opcode_str) - 1] = '\0';
+}
+
+/*
+ * Writes the state of cpu to filename. Returns 0 on success.
+ */
+int
+APEX_cpu_checkpoint_save(APEX_CPU *cpu, const char *filename)
+{
+    APEX_Ckpt_Header header;
+    int32_t word[2];
+    FILE *fp;
+    int i, ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+    header.version = CKPT_VERSION;
+    header.header_size = sizeof(header);
+    header.code_memory_size = cpu->code_memory_size;
+    header.code_checksum = ckpt_code_checksum(cpu);
+    header.pc = cpu->pc;
+    header.clock = cpu->clock;
+    header.insn_completed = cpu->insn_completed;
+    header.zero_flag = cpu->zero_flag;
+    header.fetch_from_next_cycle = cpu->fetch_from_next_cycle;
+    header.stats = cpu->stats;
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        header.regs[i] = cpu->regs[i];
+        header.valid_regs[i] = cpu->valid_regs[i];
+    }
+    for (i = 0; i < 5; ++i)
+    {
+        ckpt_save_stage(&header.stages[i], ckpt_stage(cpu, i));
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        header.num_data_words += (cpu->data_memory[i] != 0);
+    }
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (i = 0; i < DATA_MEMORY_SIZE && ok; ++i)
+    {
+        if (cpu->data_memory[i] != 0)
+        {
+            word[0] = i;
+            word[1] = cpu->data_memory[i];
+            ok = fwrite(word, sizeof(word), 1, fp) == 1;
+        }
+    }
+
+    if (fclose(fp) != 0 || !ok)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Checks that the mapped file is a checkpoint of the program cpu has loaded */
+static int
+ckpt_validate(const APEX_CPU *cpu, const char *filename, const void *map,
+              size_t size)
+{
+    const APEX_Ckpt_Header *header = map;
+
+    if (size < sizeof(header->magic) + 2 * sizeof(uint32_t)
+        || memcmp(header->magic, CKPT_MAGIC, sizeof(header->magic)) != 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not an APEX checkpoint\n", filename);
+        return FALSE;
+    }
+
+    if (header->version != CKPT_VERSION
+        || header->header_size != sizeof(APEX_Ckpt_Header))
+    {
+        fprintf(stderr, "APEX_Error: %s has checkpoint version %u, expected %d\n",
+                filename, header->version, CKPT_VERSION);
+        return FALSE;
+    }
+
+    if (size < sizeof(APEX_Ckpt_Header))
+    {
+        fprintf(stderr, "APEX_Error: %s is truncated or corrupt\n", filename);
+        return FALSE;
+    }
+
+    if (header->code_memory_size != (uint32_t)cpu->code_memory_size
+        || header->code_checksum != ckpt_code_checksum(cpu))
+    {
+        fprintf(stderr, "APEX_Error: %s was taken from a different program\n",
+                filename);
+        return FALSE;
+    }
+
+    if (header->num_data_words > DATA_MEMORY_SIZE
+        || size != sizeof(APEX_Ckpt_Header)
+                    + header->num_data_words * 2 * sizeof(int32_t))
+    {
+        fprintf(stderr, "APEX_Error: %s is truncated or corrupt\n", filename);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Restores the state of cpu from filename, which must have been saved from
+ * the same program. Returns 0 on success.
+ */
+int
+APEX_cpu_checkpoint_load(APEX_CPU *cpu, const char *filename)
+{
+    const APEX_Ckpt_Header *header;
+    const int32_t *words;
+    struct stat st;
+    void *map;
+    int fd, i, ret = -1;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open checkpoint %s\n", filename);
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not an APEX checkpoint\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "APEX_Error: Unable to map checkpoint %s\n", filename);
+        return -1;
+    }
+
+    if (ckpt_validate(cpu, filename, map, st.st_size))
+    {
+        header = map;
+        words = (const int32_t *)(header + 1);
+
+        cpu->pc = header->pc;
+        cpu->clock = header->clock;
+        cpu->insn_completed = header->insn_completed;
+        cpu->zero_flag = header->zero_flag;
+        cpu->fetch_from_next_cycle = header->fetch_from_next_cycle;
+        cpu->stats = header->stats;
+        for (i = 0; i < REG_FILE_SIZE; ++i)
+        {
+            cpu->regs[i] = header->regs[i];
+            cpu->valid_regs[i] = header->valid_regs[i];
+        }
+        for (i = 0; i < 5; ++i)
+        {
+            ckpt_restore_stage(ckpt_stage(cpu, i), &header->stages[i]);
+        }
+
+        memset(cpu->data_memory, 0, sizeof(cpu->data_memory));
+        ret = 0;
+        for (i = 0; i < (int)header->num_data_words; ++i)
+        {
+            if (words[2 * i] < 0 || words[2 * i] >= DATA_MEMORY_SIZE)
+            {
+                fprintf(stderr, "APEX_Error: %s has data memory address %d out of range\n",
+                        filename, words[2 * i]);
+                ret = -1;
+                break;
+            }
+            cpu->data_memory[words[2 * i]] = words[2 * i + 1];
+        }
+    }
+
+    munmap(map, st.st_size);
+    return ret;
+}
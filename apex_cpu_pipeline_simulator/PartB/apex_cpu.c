@@ -10,14 +10,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "apex_cfg.h"
 #include "apex_cpu.h"
 #include "apex_macros.h"
 
-int memEmpty = 0;
-int exeEmpty = 0;
-int memReg;
-int memRes;
-int exeReg , exeRes;
 /* Converts the PC(4000 series) into array index for code memory
  *
  * Note: You are not supposed to edit this function
@@ -174,6 +170,7 @@ static void
 print_reg_file(const APEX_CPU *cpu)
 {
     int i;
+    HOST_PROFILE_BEGIN(HOST_OUTPUT);
 
     printf("----------\n%s\n----------\n", "Registers:");
 
@@ -190,1828 +187,916 @@ print_reg_file(const APEX_CPU *cpu)
     }
 
     printf("\n");
+    HOST_PROFILE_END(HOST_OUTPUT);
+}
+
+/* Returns TRUE if pc is the address of an instruction in code memory */
+static int
+valid_code_pc(const APEX_CPU *cpu, int pc)
+{
+    return pc >= 4000 && (pc - 4000) % 4 == 0
+           && get_code_memory_index_from_pc(pc) < cpu->code_memory_size;
+}
+
+/* Returns TRUE if opcode writes its result to register rd */
+static int
+writes_register(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_ADDL:
+        case OPCODE_SUB:
+        case OPCODE_SUBL:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* Counts where decode read operand slot of its instruction from */
+static void
+cover_operand(APEX_CPU *cpu, int slot, int source)
+{
+    if (cpu->coverage && cpu->decode.opcode >= 0
+        && cpu->decode.opcode < NUM_OPCODES)
+    {
+        cpu->coverage->reads[cpu->decode.opcode][slot][source]++;
+    }
 }
 
 /*
- * Fetch Stage of APEX Pipeline
+ * Reads register reg, operand slot of the instruction in decode. Results
+ * which have not been written back yet are forwarded from the instruction
+ * that left execute this cycle (now in the memory latch) or the one that left
+ * memory (now in the writeback latch), youngest first.
  *
- * Note: You are free to edit this function according to your implementation
+ * Returns FALSE if the value is not available yet, which only happens when
+ * the producer is a load that has not been through the memory stage; reg is
+ * then flagged in stalled_regs. Forwarded operands are counted in forwards by
+ * the stage that produced them.
  */
-static void
-APEX_fetch(APEX_CPU *cpu)
+static int
+read_operand(APEX_CPU *cpu, int slot, int reg, int *value, int *forwards,
+             int *stalled_regs)
 {
-    APEX_Instruction *current_ins;
-
-    if (cpu->fetch.has_insn)
+    if (cpu->memory.has_insn && cpu->memory.rd == reg)
     {
-        /* This fetches new branch target instruction from next cycle */
-        if (cpu->fetch_from_next_cycle == TRUE)
+        if (cpu->memory.opcode == OPCODE_LOAD || cpu->memory.opcode == OPCODE_LDR)
         {
-            cpu->fetch_from_next_cycle = FALSE;
-
-            /* Skip this cycle*/
-            return;
+            stalled_regs[reg] = TRUE;
+            cover_operand(cpu, slot, COVERAGE_STALL);
+            return FALSE;
         }
+        *value = cpu->memory.result_buffer;
+        forwards[STAGE_EXECUTE]++;
+        cover_operand(cpu, slot, COVERAGE_EXECUTE);
+    }
+    else if (cpu->writeback.has_insn && cpu->writeback.rd == reg)
+    {
+        *value = cpu->writeback.result_buffer;
+        forwards[STAGE_MEMORY]++;
+        cover_operand(cpu, slot, COVERAGE_MEMORY);
+    }
+    else
+    {
+        *value = cpu->regs[reg];
+        cover_operand(cpu, slot, COVERAGE_REGFILE);
+    }
 
-        /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
+    /* A timing only cpu does not model values */
+    if (cpu->timing_only)
+    {
+        *value = 0;
+    }
+    return TRUE;
+}
 
-        /* Index into code memory using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.rs3 = current_ins->rs3;
-        cpu->fetch.imm = current_ins->imm;
+/* Returns the profile of the instruction at pc, NULL unless profiling */
+static APEX_PC_Profile *
+pc_profile(APEX_CPU *cpu, int pc)
+{
+    if (!cpu->profile)
+    {
+        return NULL;
+    }
+    return &cpu->profile[get_code_memory_index_from_pc(pc)];
+}
 
-        if(cpu->decode.stalled == 0)
-        {
-            /* Update PC for next instruction */
-            cpu->pc += 4;
+/*
+ * Returns the outcome of the branch in execute, zero_flag_taken for a normal
+ * cpu. A timing only cpu does not model the zero flag and takes
+ * recorded_taken, the outcome its record source gave, instead. Outcomes are
+ * fed to the branch predictor bank, if any.
+ */
+static int
+branch_taken(APEX_CPU *cpu, int zero_flag_taken, int recorded_taken)
+{
+    int taken = cpu->timing_only ? recorded_taken : zero_flag_taken;
 
-            /* Copy data from fetch latch to decode latch*/
-            cpu->decode = cpu->fetch;
+    if (cpu->bpred)
+    {
+        APEX_bpred_branch(cpu, cpu->execute.pc, cpu->execute.imm, taken);
+    }
+    return taken;
+}
 
-        }
-        else
-        {
-            (cpu->fetch.stalled = 1);
-        }
+/* Sends the target of the taken branch in execute to the fetch unit */
+static void
+redirect_fetch(APEX_CPU *cpu)
+{
+    APEX_PC_Profile *profile = pc_profile(cpu, cpu->execute.pc);
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Fetch", &cpu->fetch);
-        }
+    /* Calculate new PC, and send it to fetch unit */
+    cpu->pc = cpu->execute.pc + cpu->execute.imm;
 
-        /* Stop fetching new instructions if HALT is fetched */
-        //if (cpu->fetch.opcode == OPCODE_HALT && cpu->decode.stalled == 0)
-       // {
-         //   //printf("Halt detected\n");
-           // cpu->decode = cpu->fetch;
-            //cpu->fetch.has_insn = FALSE;
-       // }
-    }
+    /* Since we are using reverse callbacks for pipeline stages,
+     * this will prevent the new instruction from being fetched in the current cycle*/
+    cpu->fetch_from_next_cycle = TRUE;
 
-    else if(cpu->decode.stalled == 0 && cpu->fetch.opcode != OPCODE_HALT)
+    /* Flush previous stages */
+    if (cpu->konata)
     {
- 		/* Update PC for next instruction */
-            //cpu->pc += 4;
-
-            /* Copy data from fetch latch to decode latch*/
-            cpu->decode = cpu->fetch;
-            //cpu->fetch.stalled = 0;
- 	   }
-    else
+        if (cpu->decode.has_insn)
+        {
+            APEX_konata_flush(cpu, &cpu->decode);
+        }
+        APEX_konata_flush(cpu, &cpu->fetch);
+    }
+    cpu->fetch.seq = 0;
+    cpu->stats.branch_flushes++;
+    cpu->stats.squashed += cpu->decode.has_insn;
+    cpu->decode.has_insn = FALSE;
+    cpu->stats.bubble[STAGE_DECODE] = CPI_CONTROL;
+    if (profile)
     {
-        cpu->fetch.has_insn = FALSE;
-        printf("fetch   :   EMPTY\n");
+        profile->flushes++;
     }
 
+    /* Make sure fetch stage is enabled to start fetching from new PC */
+    cpu->fetch.has_insn = TRUE;
+
+    cpu->decode.stalled = 0;
+    cpu->fetch.stalled = 0;
 }
 
 /*
- * Decode Stage of APEX Pipeline
+ * Fetch Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static void
-APEX_decode(APEX_CPU *cpu)
+APEX_fetch(APEX_CPU *cpu)
 {
-    if (cpu->decode.has_insn && cpu->decode.stalled == 0)
+    APEX_Instruction *current_ins;
+
+    if (cpu->fetch.has_insn)
     {
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
+        /* This fetches new branch target instruction from next cycle */
+        if (cpu->fetch_from_next_cycle == TRUE)
         {
+            cpu->fetch_from_next_cycle = FALSE;
+            cpu->stats.empty[STAGE_FETCH]++;
+            cpu->stats.bubble[STAGE_DECODE] = CPI_CONTROL;
 
-            case OPCODE_ADD:
-            {
-              /*
-              if(cpu->valid_regs[cpu->decode.rs1] == 0 && cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                  cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                  cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else if(cpu->valid_regs[cpu->decode.rs1] == 0 && cpu->valid_regs[cpu->decode.rs2] != 0)
-              {
-                if(cpu->decode.rs2 == cpu->execute.rd)
-                {
-                  cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                  cpu->decode.rs2_value = cpu->execute.result_buffer;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else if(cpu->decode.rs2 == memReg)
-                {
-                  cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                  cpu->decode.rs2_value = memRes;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else
-                {
-                  cpu->decode.stalled = 1;
-                  cpu->fetch.stalled = 1;
-                }
-              }
-              else if(cpu->valid_regs[cpu->decode.rs2] == 0 && cpu->valid_regs[cpu->decode.rs1] != 0)
-              {
-                if(cpu->decode.rs1 == cpu->execute.rd)
-                {
-                  cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                  cpu->decode.rs1_value = cpu->execute.result_buffer;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else if(cpu->decode.rs1 == memReg)
-                {
-                  cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                  cpu->decode.rs1_value = memRes;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else
-                {
-                  cpu->decode.stalled = 1;
-                  cpu->fetch.stalled = 1;
-                }
-              }
-              else if(cpu->valid_regs[cpu->decode.rs1] != 0 && cpu->valid_regs[cpu->decode.rs2] != 0 && cpu->decode.rs2 == cpu->decode.rs1)
-              {
-                if(cpu->decode.rs1 == cpu->execute.rd)
-                {
-                  cpu->decode.rs2_value = cpu->execute.result_buffer;
-                  cpu->decode.rs1_value = cpu->execute.result_buffer;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else if(cpu->decode.rs1 == memReg)
-                {
-                  cpu->decode.rs2_value = memRes;
-                  cpu->decode.rs1_value = memRes;
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else
-                {
-                  cpu->decode.stalled = 1;
-                  cpu->fetch.stalled = 1;
-                }
-              }
-
-*/
-              int rs1_val , rs2_val = 0;
-
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                //printf("Execute RD = R%d\n", cpu->execute.rd);
-                if(cpu->valid_regs[cpu->execute.rd] == 0)
-                {
-                  cpu->decode.rs1_value = cpu->regs[cpu->execute.rd];
-                }
-                else
-                {
-                  cpu->decode.rs1_value = cpu->execute.result_buffer;
-                }
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                if(cpu->valid_regs[memReg] == 0)
-                {
-                  cpu->decode.rs1_value = cpu->regs[memReg];
-                }
-                else
-                {
-                  cpu->decode.rs1_value = memRes;
-                }
-
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                //printf("It is matching\n");
-                if(cpu->valid_regs[cpu->execute.rd] == 0)
-                {
-                  //printf("1\n");
-                  cpu->decode.rs2_value = cpu->regs[cpu->execute.rd];
-                }
-                else
-                {
-                  //printf("2\n");
-                  cpu->decode.rs2_value = cpu->execute.result_buffer;
-                }
-                //printf("RS2 value = %d\n",cpu->decode.rs2_value);
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                if(cpu->valid_regs[memReg] == 0)
-                {
-                  cpu->decode.rs2_value = cpu->regs[memReg];
-                }
-                else
-                {
-                  cpu->decode.rs2_value = memRes;
-                }
-
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-              //printf("Register status in ADD %d-val=%d, %d-val=%d\n",rs1_val,cpu->decode.rs1_value,rs2_val,cpu->decode.rs2_value);
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            case OPCODE_LOAD:
-            {
-              int rs1_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-              if(rs1_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            case OPCODE_MOVC:
-            {
-                /* MOVC doesn't have register operands */
-                cpu->valid_regs[cpu->decode.rd] = 1;
-
-                break;
-            }
+            /* Skip this cycle*/
+            return;
+        }
 
-            case OPCODE_ADDL:
-            {
-              int rs1_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-              if(rs1_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-            case OPCODE_SUB:
-            {
-              //printf("Inside decode subl\n");
-              //printf("Execute, Memory rd is - R%d, R%d-----R%d\n",cpu->execute.rd,memReg,cpu->writeback.rd);
-
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                //printf("Values= %d,%d\n",cpu->decode.rs1_value,cpu->decode.rs2_value);
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-            case OPCODE_SUBL:
+        /* Past the end of code memory there is nothing to fetch, but a
+         * branch still in the pipeline may redirect fetch */
+        if (!valid_code_pc(cpu, cpu->pc))
+        {
+            cpu->stats.empty[STAGE_FETCH]++;
+            cpu->stats.bubble[STAGE_DECODE] = CPI_CONTROL;
+            if (cpu->debug_messages)
             {
-              int rs1_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-              if(rs1_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
+                printf("Fetch          :   EMPTY\n");
             }
-            case OPCODE_MUL:
-            {
-                //printf("Register status: %d, %d\n", cpu->valid_regs[cpu->decode.rs1], cpu->valid_regs[cpu->decode.rs2]);
-                int rs1_val , rs2_val = 0;
-                if(cpu->valid_regs[cpu->decode.rs1] == 0)
-                {
-                  cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                  rs1_val = 1;
-                }
-                else if(cpu->decode.rs1 == cpu->execute.rd)
-                {
-                  if(cpu->valid_regs[cpu->execute.rd] == 0)
-                  {
-                    cpu->decode.rs1_value = cpu->regs[cpu->execute.rd];
-                  }
-                  else
-                  {
-                    cpu->decode.rs1_value = cpu->execute.result_buffer;
-                  }
-                  rs1_val = 1;
-                }
-                else if(cpu->decode.rs1 == memReg)
-                {
-                  if(cpu->valid_regs[memReg] == 0)
-                  {
-                    cpu->decode.rs1_value = cpu->regs[memReg];
-                  }
-                  else
-                  {
-                    cpu->decode.rs1_value = memRes;
-                  }
-
-                  rs1_val = 1;
-                }
-                else
-                {
-                  rs1_val = 0;
-                }
-
-                if(cpu->valid_regs[cpu->decode.rs2] == 0)
-                {
-                  cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                  rs2_val = 1;
-                }
-                else if(cpu->decode.rs2 == cpu->execute.rd)
-                {
-                  cpu->decode.rs2_value = cpu->execute.result_buffer;
-                  rs2_val = 1;
-                }
-                else if(cpu->decode.rs2 == memReg)
-                {
-                  cpu->decode.rs2_value = memRes;
-                  rs2_val = 1;
-                }
-                else
-                {
-                  rs2_val = 0;
-                }
+            return;
+        }
 
-                if(rs1_val * rs2_val == 1)
-                {
-                  cpu->valid_regs[cpu->decode.rd] = 1;
-                }
-                else
-                {
-                  cpu->decode.stalled = 1;
-                  cpu->fetch.stalled = 1;
-                }
-                  break;
-            }
-            case OPCODE_DIV:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-              //printf("Division regs = %d,%d\n",cpu->decode.rs1_value,cpu->decode.rs2_value);
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-            case OPCODE_AND:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-            case OPCODE_OR:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-            case OPCODE_XOR:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
+        /* Store current PC in fetch latch */
+        cpu->fetch.pc = cpu->pc;
 
-            case OPCODE_LDR:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            case OPCODE_STORE:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                cpu->decode.rd = -1;
-                //cpu->valid_regs[cpu->decode.rd] = 1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            case OPCODE_STR:
-            {
-              int rs1_val , rs2_val, rs3_val  = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs3] == 0)
-              {
-                cpu->decode.rs3_value = cpu->regs[cpu->decode.rs3];
-                rs3_val = 1;
-              }
-              else if(cpu->decode.rs3 == cpu->execute.rd)
-              {
-                cpu->decode.rs3_value = cpu->execute.result_buffer;
-                rs3_val = 1;
-              }
-              else if(cpu->decode.rs3 == memReg)
-              {
-                cpu->decode.rs3_value = memRes;
-                rs3_val = 1;
-              }
-              else
-              {
-                rs3_val = 0;
-              }
-
-              if(rs1_val * rs2_val * rs3_val == 1)
-              {
-                //cpu->valid_regs[cpu->decode.rd] = 1;
-                cpu->decode.rd = -1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            case OPCODE_BZ:
-            {
-                /* BZ doesn't have register operands */
-                cpu->decode.rd = -1;
-                break;
-            }
-
-            case OPCODE_BNZ:
-            {
-                /* BNZ doesn't have register operands */
-                cpu->decode.rd = -1;
-                break;
-            }
-
-            case OPCODE_HALT:
-            {
-                /* HALT doesn't have register operands */
-                cpu->decode.rd = -1;
-                break;
-            }
-
-            case OPCODE_NOP:
-            {
-                /* NOP doesn't have register operands */
-                cpu->decode.rd = -1;
-                break;
-            }
-
-            case OPCODE_CMP:
-            {
-              int rs1_val , rs2_val = 0;
-              if(cpu->valid_regs[cpu->decode.rs1] == 0)
-              {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == cpu->execute.rd)
-              {
-                cpu->decode.rs1_value = cpu->execute.result_buffer;
-                rs1_val = 1;
-              }
-              else if(cpu->decode.rs1 == memReg)
-              {
-                cpu->decode.rs1_value = memRes;
-                rs1_val = 1;
-              }
-              else
-              {
-                rs1_val = 0;
-              }
-
-              if(cpu->valid_regs[cpu->decode.rs2] == 0)
-              {
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == cpu->execute.rd)
-              {
-                cpu->decode.rs2_value = cpu->execute.result_buffer;
-                rs2_val = 1;
-              }
-              else if(cpu->decode.rs2 == memReg)
-              {
-                cpu->decode.rs2_value = memRes;
-                rs2_val = 1;
-              }
-              else
-              {
-                rs2_val = 0;
-              }
-
-              if(rs1_val * rs2_val == 1)
-              {
-                //printf("Values= %d,%d\n",cpu->decode.rs1_value,cpu->decode.rs2_value);
-                //cpu->valid_regs[cpu->decode.rd] = 1;
-                cpu->decode.rd = -1;
-              }
-              else
-              {
-                cpu->decode.stalled = 1;
-                cpu->fetch.stalled = 1;
-              }
-                break;
-            }
-
-            default:
-            {
-                break;
-            }
-        }
-
-        if(cpu->execute.stalled == 0 && cpu->decode.stalled == 0){
-            /* Copy data from decode latch to execute latch*/
-            //printf("Invalidated Register= R%d\n",cpu->decode.rd);
-            //cpu->valid_regs[cpu->decode.rd] = 1;
-            cpu->execute = cpu->decode;
-            exeEmpty = 0;
-
-            if (ENABLE_DEBUG_MESSAGES)
-            {
-                print_stage_content("Decode/RF", &cpu->decode);
-            }
-            //cpu->decode.has_insn = FALSE;
-
-        }
-        else
-        {
-            if (ENABLE_DEBUG_MESSAGES)
-            {
-              if(cpu->decode.has_insn == FALSE)
-              {
-                printf("Decode/RF      :     EMPTY\n");
-              }
-              else
-              {
-                print_stage_content("Decode/RF", &cpu->decode);
-              }
-                exeEmpty = 1;
-                //cpu->decode.has_insn = FALSE;
-                //printf("val --%d, %d\n",cpu->execute.stalled, cpu->decode.stalled );
-            }
-            //cpu->decode.stalled = 1;
-        }
-    }
-    else
-    {
-        if (ENABLE_DEBUG_MESSAGES)
-            {
-              if(cpu->decode.has_insn == FALSE)
-              {
-                printf("Decode/RF      :     EMPTY\n");
-              }
-              else
-              {
-                print_stage_content("Decode/RF", &cpu->decode);
-              }
-                exeEmpty = 1;
-                //cpu->decode.has_insn = FALSE;
-                //printf("val --%d, %d\n",cpu->execute.stalled, cpu->decode.stalled );
-            }
-    }
-
-}
-
-/*
- * Execute Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
- */
-static void
-APEX_execute(APEX_CPU *cpu)
-{
-    if (cpu->execute.has_insn && cpu->execute.stalled == 0)
-    {
-      exeEmpty = 0;
-        /* Execute logic based on instruction type */
-        switch (cpu->execute.opcode)
-        {
-            case OPCODE_ADD:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
-                //printf("Values being added in execute = %d, %d\n",cpu->execute.rs1_value , cpu->execute.rs2_value);
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_LOAD:
-            {
-                cpu->execute.memory_address
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-                break;
-            }
-
-            case OPCODE_BZ:
-            {
-
-                if (cpu->zero_flag == TRUE)
-                {
-                  if(strncmp(cpu->decode.opcode_str, "HALT",1) == 0)
-                  {
-                    break;
-                  }
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-
-                    /* Since we are using reverse callbacks for pipeline stages,
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-
-                    cpu->decode.stalled = 0;
-                    cpu->fetch.stalled = 0;
-                }
-                break;
-            }
-
-            case OPCODE_BNZ:
-            {
-                if (cpu->zero_flag == FALSE)
-                {
-                  if(strncmp(cpu->decode.opcode_str, "HALT",1) == 0)
-                  {
-                    break;
-                  }
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-
-                    /* Since we are using reverse callbacks for pipeline stages,
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
-            case OPCODE_MOVC:
-            {
-                cpu->execute.result_buffer = cpu->execute.imm;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_ADDL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_SUB:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_SUBL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.imm;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_MUL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value * cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_DIV:
-            {
-                if (cpu->execute.rs2_value != 0)
-                {
-                  cpu->execute.result_buffer = cpu->execute.rs1_value / cpu->execute.rs2_value;
-                }
-                else
-                {
-                  fprintf(stderr, "Division By Zero Returning Value Zero\n");
-                  cpu->execute.result_buffer = 0;
-                }
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_AND:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value & cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_OR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value | cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_XOR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-
-            case OPCODE_LDR:
-            {
-                cpu->execute.memory_address
-                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
-                break;
-            }
-
-            case OPCODE_STORE:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value;
-
-                cpu->execute.memory_address
-                    = cpu->execute.rs2_value + cpu->execute.imm;
-                break;
-            }
-
-            case OPCODE_STR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value;
-
-                cpu->execute.memory_address
-                    = cpu->execute.rs2_value + cpu->execute.rs3_value;
-
-                break;
-            }
-
-            case OPCODE_HALT:
-            {
-                /* HALT doesn't have register operands */
-                break;
-            }
-
-            case OPCODE_NOP:
-            {
-                /* NOP doesn't have register operands */
-                break;
-            }
-
-            case OPCODE_CMP:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                }
-                else
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
+        /* Index into code memory using this pc and copy all instruction fields
+         * into fetch latch  */
+        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
+        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
+        cpu->fetch.opcode = current_ins->opcode;
+        cpu->fetch.rd = current_ins->rd;
+        cpu->fetch.rs1 = current_ins->rs1;
+        cpu->fetch.rs2 = current_ins->rs2;
+        cpu->fetch.rs3 = current_ins->rs3;
+        cpu->fetch.imm = current_ins->imm;
 
-            default:
+        /* Number the instruction the first cycle it is fetched, fetch keeps
+         * it while decode is stalled */
+        if (!cpu->fetch.seq)
+        {
+            cpu->fetch.seq = ++cpu->insn_fetched;
+            cpu->fetch.enter[STAGE_FETCH] = cpu->clock;
+            if (cpu->konata)
             {
-                break;
+                APEX_konata_fetch(cpu, &cpu->fetch);
             }
         }
 
-        /* Copy data from execute latch to memory latch*/
-        cpu->memory = cpu->execute;
-        cpu->execute.has_insn = FALSE;
-        memEmpty = 0;
+        if(cpu->decode.stalled == 0)
+        {
+            /* Update PC for next instruction */
+            cpu->pc += 4;
+            cpu->stats.busy[STAGE_FETCH]++;
+
+            /* Copy data from fetch latch to decode latch*/
+            cpu->fetch.stalled = 0;
+            cpu->decode = cpu->fetch;
+            cpu->fetch.seq = 0;
 
-        if (ENABLE_DEBUG_MESSAGES)
+            /* Stop fetching new instructions if HALT is fetched */
+            if (cpu->fetch.opcode == OPCODE_HALT)
+            {
+                cpu->fetch.has_insn = FALSE;
+            }
+        }
+        else
         {
-            print_stage_content("Execute", &cpu->execute);
+            (cpu->fetch.stalled = 1);
+            cpu->stats.stalled[STAGE_FETCH]++;
+        }
+
+        if (cpu->debug_messages)
+        {
+            print_stage_content("Fetch", &cpu->fetch);
         }
     }
     else
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        cpu->stats.empty[STAGE_FETCH]++;
+        cpu->stats.bubble[STAGE_DECODE] = CPI_DRAIN;
+        if (cpu->debug_messages)
         {
-            printf("Execute         :   EMPTY\n");
-            memEmpty = 1;
+            printf("Fetch          :   EMPTY\n");
         }
     }
-
 }
 
 /*
- * Memory Stage of APEX Pipeline
+ * Decode Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static void
-APEX_memory(APEX_CPU *cpu)
+APEX_decode(APEX_CPU *cpu)
 {
-    if (cpu->memory.has_insn)
+    APEX_PC_Profile *profile = NULL;
+    int forwards[NUM_STAGES] = {0};
+    int stalled_regs[REG_FILE_SIZE] = {0};
+    int was_stalled = cpu->decode.stalled;
+    int ready = TRUE;
+    int i;
+
+    /* Operands are read again every cycle until all of them are available */
+    cpu->decode.stalled = 0;
+
+    if (cpu->decode.has_insn)
     {
-      memEmpty = 0;
-      memReg = cpu->memory.rd;
-      memRes = cpu->memory.result_buffer;
-        switch (cpu->memory.opcode)
+        profile = pc_profile(cpu, cpu->decode.pc);
+        if (!was_stalled)
         {
+            cpu->decode.enter[STAGE_DECODE] = cpu->clock;
+            if (cpu->konata)
+            {
+                APEX_konata_stage(cpu, &cpu->decode, "D");
+            }
+        }
 
+        /* Read operands from register file based on the instruction type */
+        switch (cpu->decode.opcode)
+        {
             case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            case OPCODE_LDR:
+            case OPCODE_CMP:
+            case OPCODE_STORE:
             {
-                /* No work for ADD */
+                ready = read_operand(cpu, 0, cpu->decode.rs1,
+                                     &cpu->decode.rs1_value, forwards,
+                                     stalled_regs);
+                ready &= read_operand(cpu, 1, cpu->decode.rs2,
+                                      &cpu->decode.rs2_value, forwards,
+                                      stalled_regs);
                 break;
             }
 
+            case OPCODE_ADDL:
+            case OPCODE_SUBL:
             case OPCODE_LOAD:
             {
-                /* Read from data memory */
-                cpu->memory.result_buffer
-                    = cpu->data_memory[cpu->memory.memory_address];
+                ready = read_operand(cpu, 0, cpu->decode.rs1,
+                                     &cpu->decode.rs1_value, forwards,
+                                     stalled_regs);
                 break;
             }
 
-            case OPCODE_LDR:
+            case OPCODE_STR:
             {
-                /* Read from data memory */
-                cpu->memory.result_buffer
-                    = cpu->data_memory[cpu->memory.memory_address];
+                ready = read_operand(cpu, 0, cpu->decode.rs1,
+                                     &cpu->decode.rs1_value, forwards,
+                                     stalled_regs);
+                ready &= read_operand(cpu, 1, cpu->decode.rs2,
+                                      &cpu->decode.rs2_value, forwards,
+                                      stalled_regs);
+                ready &= read_operand(cpu, 2, cpu->decode.rs3,
+                                      &cpu->decode.rs3_value, forwards,
+                                      stalled_regs);
                 break;
             }
 
-            case OPCODE_STORE:
+            case OPCODE_MOVC:
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_HALT:
+            case OPCODE_NOP:
+            default:
             {
-                /* Read from data memory */
-                    cpu->data_memory[cpu->memory.memory_address] = cpu->memory.result_buffer;
+                /* No register operands */
                 break;
             }
+        }
 
-            case OPCODE_STR:
+        /* A register named by several operands stalls decode only once */
+        for (i = 0; i < REG_FILE_SIZE; ++i)
+        {
+            cpu->stats.raw_stalls[STAGE_EXECUTE][i] += stalled_regs[i];
+        }
+
+        if (ready && cpu->execute.stalled == 0)
+        {
+            /* Mark the destination register as pending until writeback */
+            if (writes_register(cpu->decode.opcode))
             {
-                /* Read from data memory */
-                cpu->data_memory[cpu->memory.memory_address] = cpu->memory.result_buffer;
-                break;
+                cpu->valid_regs[cpu->decode.rd] = 1;
+            }
+            else
+            {
+                cpu->decode.rd = -1;
             }
 
-            case OPCODE_MOVC:
+            if (cpu->konata && was_stalled)
             {
-                /* Read from data memory */
-                //printf("Destination res=R%d\n",cpu->memory.rd);
-                break;
+                APEX_konata_stall(cpu, &cpu->decode, FALSE);
             }
 
-            default:
+            /* Copy data from decode latch to execute latch*/
+            cpu->execute = cpu->decode;
+            cpu->decode.has_insn = FALSE;
+
+            /* Operands are counted as forwarded once the reads succeed */
+            for (i = 0; i < NUM_STAGES; ++i)
             {
-                break;
+                cpu->stats.forwards[i] += forwards[i];
+                if (profile)
+                {
+                    profile->forwards += forwards[i];
+                }
             }
+            cpu->stats.busy[STAGE_DECODE]++;
         }
+        else
+        {
+            cpu->decode.stalled = 1;
+            cpu->fetch.stalled = 1;
+            cpu->stats.stalled[STAGE_DECODE]++;
 
-        /* Copy data from memory latch to writeback latch*/
-        cpu->writeback = cpu->memory;
-        cpu->memory.has_insn = FALSE;
+            /* Every result but a load's is forwarded, so an operand that is
+             * not ready is a load-use stall */
+            cpu->stats.bubble[STAGE_EXECUTE] = ready ? CPI_STRUCTURAL
+                                                     : CPI_LOAD_USE;
+            if (profile)
+            {
+                profile->stall_cycles++;
+            }
+            if (cpu->konata && !was_stalled)
+            {
+                APEX_konata_stall(cpu, &cpu->decode, TRUE);
+            }
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (cpu->debug_messages)
         {
-            print_stage_content("Memory", &cpu->memory);
+            print_stage_content("Decode/RF", &cpu->decode);
         }
     }
     else
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        cpu->stats.empty[STAGE_DECODE]++;
+        cpu->stats.bubble[STAGE_EXECUTE] = cpu->stats.bubble[STAGE_DECODE];
+        if (cpu->debug_messages)
         {
-            printf("Memory          :  Empty\n");
-            memEmpty = 1;
+            printf("Decode/RF      :     EMPTY\n");
         }
     }
 }
 
 /*
- * Writeback Stage of APEX Pipeline
+ * Execute Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static int
-APEX_writeback(APEX_CPU *cpu)
+APEX_execute(APEX_CPU *cpu)
 {
+    int recorded_taken = 0;
+    int recorded_address = -1;
 
-    if (cpu->writeback.has_insn)
+    if (cpu->execute.has_insn && cpu->execute.stalled == 0)
     {
-      int val = 0;
-        /* Write result to register file based on instruction type */
-        switch (cpu->writeback.opcode)
+        cpu->execute.enter[STAGE_EXECUTE] = cpu->clock;
+        if (cpu->konata)
         {
-            case OPCODE_ADD:
+            APEX_konata_stage(cpu, &cpu->execute, "X");
+        }
+
+        /* A timing only cpu takes branch outcomes and data addresses from
+         * the record of the instruction */
+        if (cpu->timing_only)
+        {
+            recorded_taken = cpu->next_record(cpu->record_source,
+                                              &cpu->execute, &recorded_address);
+            if (recorded_taken < 0)
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //printf("Result value ADD = %d\n",cpu->writeback.result_buffer);
-                //printf("Execute Regs, Memory Regs = R%d,R%d\n",cpu->execute.rd,cpu->memory.rd);
+                return APEX_CYCLE_ERROR;
+            }
+        }
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+        /* Execute logic based on instruction type */
+        switch (cpu->execute.opcode)
+        {
+            case OPCODE_ADD:
+            {
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
+                //printf("Values being added in execute = %d, %d\n",cpu->execute.rs1_value , cpu->execute.rs2_value);
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
 
             case OPCODE_LOAD:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.memory_address
+                    = cpu->execute.rs1_value + cpu->execute.imm;
+                break;
+            }
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+            case OPCODE_BZ:
+            {
+                if (branch_taken(cpu, cpu->zero_flag == TRUE, recorded_taken))
                 {
-                  val = 1;
+                    redirect_fetch(cpu);
                 }
-                if(val == 0)
+                break;
+            }
+
+            case OPCODE_BNZ:
+            {
+                if (branch_taken(cpu, cpu->zero_flag == FALSE, recorded_taken))
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    redirect_fetch(cpu);
                 }
                 break;
             }
 
             case OPCODE_MOVC:
             {
-                  cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                  //printf("Execute Regs, Memory Regs, wb REGS = R%d,R%d,R%d\n",cpu->execute.rd,cpu->memory.rd,cpu->writeback.rd);
-                  //printf("Execute instruction = %s\n",cpu->execute.opcode_str);
+                cpu->execute.result_buffer = cpu->execute.imm;
 
-                  if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                  {
-                    printf("4\n");
-                    val = 1;
-                  }
-                  else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                  {
-                    val = 1;
-                  }
-                  else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
-                  {
-                    val = 1;
-                  }
-                  if(val == 0)
-                  {
-                    cpu->valid_regs[cpu->writeback.rd] = 0;
-                    cpu->fetch.stalled = 0;
-                    cpu->decode.stalled = 0;
-                  }
-                  break;
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
+                {
+                    cpu->zero_flag = TRUE;
+                }
+                else
+                {
+                    cpu->zero_flag = FALSE;
+                }
+                break;
             }
 
             case OPCODE_ADDL:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value + cpu->execute.imm;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_SUB:
             {
-              cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-
-              if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-              {
-                val = 1;
-              }
-              else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-              {
-                val = 1;
-              }
-              else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
-              {
-                val = 1;
-              }
-              if(val == 0)
-              {
-                cpu->valid_regs[cpu->writeback.rd] = 0;
-                cpu->fetch.stalled = 0;
-                cpu->decode.stalled = 0;
-              }
-                break;
-            }
-            case OPCODE_SUBL:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
+                else
                 {
-                  val = 1;
+                    cpu->zero_flag = FALSE;
                 }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                break;
+            }
+
+            case OPCODE_SUBL:
+            {
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value - cpu->execute.imm;
+
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_MUL:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value * cpu->execute.rs2_value;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_DIV:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
+                if (cpu->execute.rs2_value == -1)
+                {
+                  /* INT_MIN / -1 overflows the host division */
+                  cpu->execute.result_buffer
+                      = (int)(0u - (unsigned int)cpu->execute.rs1_value);
+                }
+                else if (cpu->execute.rs2_value != 0)
                 {
-                  val = 1;
+                  cpu->execute.result_buffer = cpu->execute.rs1_value / cpu->execute.rs2_value;
                 }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
+                else
                 {
-                  val = 1;
+                  if (!cpu->timing_only)
+                  {
+                    fprintf(stderr, "Division By Zero Returning Value Zero\n");
+                  }
+                  cpu->execute.result_buffer = 0;
                 }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_AND:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value & cpu->execute.rs2_value;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_OR:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value | cpu->execute.rs2_value;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
+
             case OPCODE_XOR:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
 
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                  val = 1;
+                    cpu->zero_flag = TRUE;
                 }
-                if(val == 0)
+                else
                 {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
+                    cpu->zero_flag = FALSE;
                 }
                 break;
             }
 
             case OPCODE_LDR:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-
-                if(memEmpty == 0 && exeEmpty == 0 && (cpu->memory.rd == cpu->writeback.rd || cpu->execute.rd == cpu->writeback.rd))
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 1 && exeEmpty == 0 && cpu->execute.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                else if(memEmpty == 0 && exeEmpty == 1 && cpu->memory.rd == cpu->writeback.rd)
-                {
-                  val = 1;
-                }
-                if(val == 0)
-                {
-                  cpu->valid_regs[cpu->writeback.rd] = 0;
-                  cpu->fetch.stalled = 0;
-                  cpu->decode.stalled = 0;
-                }
+                cpu->execute.memory_address
+                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
                 break;
             }
 
             case OPCODE_STORE:
             {
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value;
+
+                cpu->execute.memory_address
+                    = cpu->execute.rs2_value + cpu->execute.imm;
                 break;
             }
 
             case OPCODE_STR:
             {
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value;
+
+                cpu->execute.memory_address
+                    = cpu->execute.rs2_value + cpu->execute.rs3_value;
+
                 break;
             }
 
-            case OPCODE_BZ:
+            case OPCODE_HALT:
             {
-                /* BZ doesn't have register operands */
+                /* HALT doesn't have register operands */
+                break;
+            }
 
+            case OPCODE_NOP:
+            {
+                /* NOP doesn't have register operands */
                 break;
             }
 
-            case OPCODE_BNZ:
+            case OPCODE_CMP:
             {
-                /* BNZ doesn't have register operands */
+                cpu->execute.result_buffer
+                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
 
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
+                {
+                    cpu->zero_flag = TRUE;
+                }
+                else
+                {
+                    cpu->zero_flag = FALSE;
+                }
                 break;
             }
 
-            case OPCODE_HALT:
+            default:
             {
-                /* HALT doesn't have register operands */
                 break;
             }
+        }
 
-            case OPCODE_NOP:
+        if (cpu->timing_only)
+        {
+            cpu->execute.memory_address = recorded_address;
+        }
+
+        /* Copy data from execute latch to memory latch*/
+        cpu->memory = cpu->execute;
+        cpu->execute.has_insn = FALSE;
+        cpu->stats.busy[STAGE_EXECUTE]++;
+
+        if (cpu->debug_messages)
+        {
+            print_stage_content("Execute", &cpu->execute);
+        }
+    }
+    else
+    {
+        cpu->stats.empty[STAGE_EXECUTE]++;
+        cpu->stats.bubble[STAGE_MEMORY] = cpu->stats.bubble[STAGE_EXECUTE];
+        if (cpu->debug_messages)
+        {
+            printf("Execute         :   EMPTY\n");
+        }
+    }
+    return APEX_CYCLE_OK;
+}
+
+
+
+/*
+ * Memory Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static int
+APEX_memory(APEX_CPU *cpu)
+{
+    if (cpu->memory.has_insn)
+    {
+        cpu->memory.enter[STAGE_MEMORY] = cpu->clock;
+        if (cpu->konata)
+        {
+            APEX_konata_stage(cpu, &cpu->memory, "M");
+        }
+
+        switch (cpu->memory.opcode)
+        {
+            case OPCODE_LOAD:
+            case OPCODE_LDR:
+            case OPCODE_STORE:
+            case OPCODE_STR:
             {
-                /* NOP doesn't have register operands */
+                /* A timing only cpu has no data memory to access, only the
+                 * address its record source gave, -1 if it had none */
+                if (cpu->timing_only)
+                {
+                    if (cpu->mrc && cpu->memory.memory_address >= 0
+                        && cpu->memory.memory_address < DATA_MEMORY_SIZE)
+                    {
+                        APEX_mrc_access(cpu, cpu->memory.memory_address);
+                    }
+                    break;
+                }
+
+                if (cpu->memory.memory_address < 0
+                    || cpu->memory.memory_address >= DATA_MEMORY_SIZE)
+                {
+                    fprintf(stderr, "APEX_Error: Data memory address %d out of range at pc(%d)\n",
+                            cpu->memory.memory_address, cpu->memory.pc);
+                    return APEX_CYCLE_ERROR;
+                }
+
+                if (cpu->mrc)
+                {
+                    APEX_mrc_access(cpu, cpu->memory.memory_address);
+                }
 
+                if (cpu->memory.opcode == OPCODE_LOAD
+                    || cpu->memory.opcode == OPCODE_LDR)
+                {
+                    /* Read from data memory */
+                    cpu->memory.result_buffer
+                        = cpu->data_memory[cpu->memory.memory_address];
+                }
+                else
+                {
+                    /* Write to data memory */
+                    cpu->data_memory[cpu->memory.memory_address]
+                        = cpu->memory.result_buffer;
+                }
                 break;
             }
 
-            case OPCODE_CMP:
+            default:
             {
+                /* No work for other instructions */
                 break;
             }
+        }
 
-            default:
+        /* Copy data from memory latch to writeback latch*/
+        cpu->writeback = cpu->memory;
+        cpu->memory.has_insn = FALSE;
+        cpu->stats.busy[STAGE_MEMORY]++;
+
+        if (cpu->debug_messages)
+        {
+            print_stage_content("Memory", &cpu->memory);
+        }
+    }
+    else
+    {
+        cpu->stats.empty[STAGE_MEMORY]++;
+        cpu->stats.bubble[STAGE_WRITEBACK] = cpu->stats.bubble[STAGE_MEMORY];
+        if (cpu->debug_messages)
+        {
+            printf("Memory          :  Empty\n");
+        }
+    }
+    return APEX_CYCLE_OK;
+}
+
+/*
+ * Writeback Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static int
+APEX_writeback(APEX_CPU *cpu)
+{
+    int rd;
+
+    if (cpu->writeback.has_insn)
+    {
+        cpu->writeback.enter[STAGE_WRITEBACK] = cpu->clock;
+        if (cpu->konata)
+        {
+            APEX_konata_writeback(cpu, &cpu->writeback);
+        }
+
+        /* Write result to register file based on instruction type */
+        if (writes_register(cpu->writeback.opcode))
+        {
+            rd = cpu->writeback.rd;
+            cpu->regs[rd] = cpu->writeback.result_buffer;
+
+            /* The register stays pending if a younger instruction in
+             * execute or memory writes it as well */
+            if (!(cpu->memory.has_insn && cpu->memory.rd == rd)
+                && !(cpu->execute.has_insn && cpu->execute.rd == rd))
             {
-                break;
+                cpu->valid_regs[rd] = 0;
             }
         }
 
         cpu->insn_completed++;
         cpu->writeback.has_insn = FALSE;
+        cpu->stats.busy[STAGE_WRITEBACK]++;
+        cpu->stats.cpi_stack[CPI_BASE]++;
+        if (cpu->latency)
+        {
+            APEX_stats_latency_record(cpu, &cpu->writeback);
+        }
+        if (cpu->critical)
+        {
+            APEX_critical_retire(cpu, &cpu->writeback);
+        }
+        if (cpu->profile)
+        {
+            pc_profile(cpu, cpu->writeback.pc)->executed++;
+        }
+        if (cpu->writeback.opcode >= 0 && cpu->writeback.opcode < NUM_OPCODES)
+        {
+            cpu->stats.retired[cpu->writeback.opcode]++;
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (cpu->debug_messages)
         {
             print_stage_content("Writeback", &cpu->writeback);
         }
@@ -2024,7 +1109,9 @@ APEX_writeback(APEX_CPU *cpu)
     }
     else
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        cpu->stats.empty[STAGE_WRITEBACK]++;
+        cpu->stats.cpi_stack[cpu->stats.bubble[STAGE_WRITEBACK]]++;
+        if (cpu->debug_messages)
         {
             printf("Writeback      :  Empty\n");
         }
@@ -2033,6 +1120,88 @@ APEX_writeback(APEX_CPU *cpu)
     return 0;
 }
 
+/*
+ * Simulates one clock cycle. The stages are called in reverse order so that
+ * each of them sees what the previous stage produced in the last cycle.
+ *
+ * Returns APEX_CYCLE_HALT once HALT has been written back and
+ * APEX_CYCLE_ERROR if the program can not continue.
+ */
+int
+APEX_cpu_cycle(APEX_CPU *cpu)
+{
+    int status;
+
+    if (cpu->chrome_chunk_start && cpu->clock % CHROME_CHUNK_CYCLES == 0)
+    {
+        APEX_chrome_chunk(cpu);
+    }
+
+    if (cpu->debug_messages)
+    {
+        printf("--------------------------------------------\n");
+        printf("Clock Cycle #: %d\n", cpu->clock+1);
+        printf("--------------------------------------------\n");
+    }
+    cpu->clock++;
+
+    HOST_PROFILE_BEGIN(STAGE_WRITEBACK);
+    status = APEX_writeback(cpu);
+    HOST_PROFILE_END(STAGE_WRITEBACK);
+    if (status)
+    {
+        /* Halt in writeback stage */
+        if (cpu->chrome_chunk_start)
+        {
+            APEX_chrome_chunk(cpu);
+        }
+        return APEX_CYCLE_HALT;
+    }
+
+    HOST_PROFILE_BEGIN(STAGE_MEMORY);
+    status = APEX_memory(cpu);
+    HOST_PROFILE_END(STAGE_MEMORY);
+    if (status != APEX_CYCLE_OK)
+    {
+        return APEX_CYCLE_ERROR;
+    }
+
+    HOST_PROFILE_BEGIN(STAGE_EXECUTE);
+    status = APEX_execute(cpu);
+    HOST_PROFILE_END(STAGE_EXECUTE);
+    if (status != APEX_CYCLE_OK)
+    {
+        return APEX_CYCLE_ERROR;
+    }
+
+    HOST_PROFILE_BEGIN(STAGE_DECODE);
+    APEX_decode(cpu);
+    HOST_PROFILE_END(STAGE_DECODE);
+    HOST_PROFILE_BEGIN(STAGE_FETCH);
+    APEX_fetch(cpu);
+    HOST_PROFILE_END(STAGE_FETCH);
+
+    if (cpu->next_interval && cpu->clock >= cpu->next_interval)
+    {
+        APEX_stats_interval(cpu);
+    }
+
+    if (cpu->next_metrics && cpu->clock >= cpu->next_metrics)
+    {
+        APEX_metrics_publish(cpu, TRUE);
+    }
+
+    /* Fell off the end of code memory without a HALT */
+    if (!cpu->decode.has_insn && !cpu->execute.has_insn
+        && !cpu->memory.has_insn && !cpu->writeback.has_insn
+        && !valid_code_pc(cpu, cpu->pc))
+    {
+        fprintf(stderr, "APEX_Error: PC %d outside of code memory\n", cpu->pc);
+        return APEX_CYCLE_ERROR;
+    }
+    return APEX_CYCLE_OK;
+}
+
 /*
  * This function creates and initializes APEX cpu.
  *
@@ -2041,18 +1210,46 @@ APEX_writeback(APEX_CPU *cpu)
 APEX_CPU *
 APEX_cpu_init(const char *filename)
 {
-    int i;
+    APEX_Instruction *code_memory;
     APEX_CPU *cpu;
+    long long start;
+    int size;
 
     if (!filename)
     {
         return NULL;
     }
 
+    /* Parse input file and create code memory */
+    start = APEX_chrome_begin();
+    code_memory = create_code_memory(filename, &size);
+    APEX_chrome_end("create_code_memory", "load", start, "");
+    if (!code_memory)
+    {
+        return NULL;
+    }
+
+    start = APEX_chrome_begin();
+    cpu = APEX_cpu_init_code(code_memory, size);
+    APEX_chrome_end("APEX_cpu_init", "init", start, "");
+    return cpu;
+}
+
+/*
+ * Creates and initializes an APEX cpu running code_memory, which the cpu
+ * takes ownership of.
+ */
+APEX_CPU *
+APEX_cpu_init_code(APEX_Instruction *code_memory, int size)
+{
+    int i;
+    APEX_CPU *cpu;
+
     cpu = calloc(1, sizeof(APEX_CPU));
 
     if (!cpu)
     {
+        free(code_memory);
         return NULL;
     }
 
@@ -2061,24 +1258,36 @@ APEX_cpu_init(const char *filename)
     memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
     memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
     cpu->single_step = ENABLE_SINGLE_STEP;
+    cpu->debug_messages = ENABLE_DEBUG_MESSAGES;
     cpu->fetch.stalled = 0;
     cpu->decode.stalled = 0;
     cpu->execute.stalled = 0;
     cpu->memory.stalled = 0;
     cpu->writeback.stalled = 0;
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        /* The pipeline starts out empty */
+        cpu->stats.bubble[i] = CPI_DRAIN;
+    }
+    cpu->code_memory = code_memory;
+    cpu->code_memory_size = size;
+
+    /* Find basic blocks, this also validates all branch targets */
+    cpu->cfg = APEX_cfg_build(cpu->code_memory, cpu->code_memory_size);
+    if (!cpu->cfg)
     {
+        free(cpu->code_memory);
         free(cpu);
         return NULL;
     }
 
-    if (ENABLE_DEBUG_MESSAGES)
+    if (cpu->debug_messages)
     {
         fprintf(stderr,
                 "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
                 cpu->code_memory_size);
+        fprintf(stderr, "APEX_CPU: Found %d basic blocks, %d loop headers\n",
+                cpu->cfg->num_blocks, cpu->cfg->num_loop_headers);
         fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
         fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
         printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
@@ -2098,24 +1307,93 @@ APEX_cpu_init(const char *filename)
 }
 
 int print_register_state(APEX_CPU* cpu) {
+  long long start = APEX_chrome_begin();
+  HOST_PROFILE_BEGIN(HOST_OUTPUT);
   printf("\n=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
   int index;
   int no_registers = (int) (sizeof(cpu->regs)/sizeof(cpu->regs[0]));
   for(index = 0; index < no_registers - 1; ++index) {//Assumming CC register is also part of the register file
     printf("| \t REG[%d] \t | \t Value = %d \t | \t Status = %s \t \n", index, cpu->regs[index], (!cpu->valid_regs[index] ? "VALID" : "INVALID"));
   }
+  HOST_PROFILE_END(HOST_OUTPUT);
+  APEX_chrome_end("print_register_state", "output", start, "");
   return 0;
 }
 
 int print_data_memory(APEX_CPU* cpu) {
+  long long start = APEX_chrome_begin();
+  HOST_PROFILE_BEGIN(HOST_OUTPUT);
   printf("\n============== STATE OF DATA MEMORY =============\n");
   int index;
   for(index = 0; index < 1000; ++index) {
     printf("| \t MEM[%d] \t | \t Data Value = %d \t |\n", index, cpu->data_memory[index]);
   }
+  HOST_PROFILE_END(HOST_OUTPUT);
+  APEX_chrome_end("print_data_memory", "output", start, "");
   return 0;
 }
 
+/* Saves the checkpoint requested by the user, returns FALSE on failure */
+static int
+save_checkpoint(APEX_CPU *cpu)
+{
+    long long start = APEX_chrome_begin();
+    int ret = APEX_cpu_checkpoint_save(cpu, cpu->checkpoint_file);
+
+    APEX_chrome_end("APEX_cpu_checkpoint_save", "checkpoint", start, "");
+    if (ret < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write checkpoint %s\n",
+                cpu->checkpoint_file);
+        return FALSE;
+    }
+    printf("APEX_CPU: Checkpoint written to %s, cycles = %d instructions = %d\n",
+           cpu->checkpoint_file, cpu->clock, cpu->insn_completed);
+    return TRUE;
+}
+
+/*
+ * Prints how the simulation ended if status ends it, returns TRUE if so. A
+ * simulation also ends once the checkpoint cycle has been simulated.
+ */
+static int
+simulation_ended(APEX_CPU *cpu, int status)
+{
+    if (status == APEX_CYCLE_HALT)
+    {
+        /* Halt in writeback stage */
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+        APEX_stats_print_cpi_stack(cpu);
+        return TRUE;
+    }
+
+    if (status == APEX_CYCLE_ERROR)
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+        APEX_stats_print_cpi_stack(cpu);
+        return TRUE;
+    }
+
+    if (cpu->checkpoint_at > 0 && cpu->clock == cpu->checkpoint_at)
+    {
+        save_checkpoint(cpu);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Prints that the user quit, keeping the state if a checkpoint file is set */
+static void
+simulation_quit(APEX_CPU *cpu)
+{
+    printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+    APEX_stats_print_cpi_stack(cpu);
+    if (cpu->checkpoint_file)
+    {
+        save_checkpoint(cpu);
+    }
+}
+
 /*
  * APEX CPU simulation loop
  *
@@ -2128,25 +1406,11 @@ APEX_cpu_run(APEX_CPU *cpu)
 
     while (TRUE)
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        if (simulation_ended(cpu, APEX_cpu_cycle(cpu)))
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
-            printf("--------------------------------------------\n");
-        }
-
-        if (APEX_writeback(cpu))
-        {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
         print_reg_file(cpu);
 
         if (cpu->single_step)
@@ -2156,12 +1420,10 @@ APEX_cpu_run(APEX_CPU *cpu)
 
             if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
             {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+                simulation_quit(cpu);
                 break;
             }
         }
-
-        cpu->clock++;
     }
 
     print_register_state(cpu);
@@ -2170,7 +1432,8 @@ APEX_cpu_run(APEX_CPU *cpu)
 
 
 /*
- * APEX CPU simulation loop
+ * APEX CPU simulation loop, runs the first c - 1 cycles without stopping and
+ * then single steps
  *
  * Note: You are free to edit this function according to your implementation
  */
@@ -2181,53 +1444,23 @@ APEX_cpu_simulate(APEX_CPU *cpu, int c)
 
     while (c != 1)
     {
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
-            printf("--------------------------------------------\n");
-        }
-
-        if (APEX_writeback(cpu))
+        if (simulation_ended(cpu, APEX_cpu_cycle(cpu)))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
-            break;
+            print_register_state(cpu);
+            print_data_memory(cpu);
+            return;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
         print_reg_file(cpu);
-
-
-
-        cpu->clock++;
         c--;
     }
     while(TRUE)
     {
-      if (ENABLE_DEBUG_MESSAGES)
-      {
-          printf("--------------------------------------------\n");
-          printf("Clock Cycle #: %d\n", cpu->clock+1);
-          printf("--------------------------------------------\n");
-      }
-
-      if (APEX_writeback(cpu))
+      if (simulation_ended(cpu, APEX_cpu_cycle(cpu)))
       {
-          /* Halt in writeback stage */
-          printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
           break;
       }
 
-      APEX_memory(cpu);
-      APEX_execute(cpu);
-      APEX_decode(cpu);
-      APEX_fetch(cpu);
-
       print_reg_file(cpu);
       if (cpu->single_step)
       {
@@ -2236,10 +1469,9 @@ APEX_cpu_simulate(APEX_CPU *cpu, int c)
 
           if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
           {
-              printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+              simulation_quit(cpu);
               break;
           }
-          cpu->clock++;
       }
     }
 
@@ -2259,28 +1491,12 @@ APEX_cpu_display(APEX_CPU *cpu)
     int c = 10;
     while (c != 0)
     {
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
-            printf("--------------------------------------------\n");
-        }
-
-        if (APEX_writeback(cpu))
+        if (simulation_ended(cpu, APEX_cpu_cycle(cpu)))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
         print_reg_file(cpu);
-
-        cpu->clock++;
         c--;
     }
 
@@ -2296,6 +1512,16 @@ APEX_cpu_display(APEX_CPU *cpu)
 void
 APEX_cpu_stop(APEX_CPU *cpu)
 {
+#if ENABLE_HOST_PROFILE
+    APEX_host_profile_print();
+#endif
+    APEX_cfg_free(cpu->cfg);
+    free(cpu->profile);
+    free(cpu->latency);
+    free(cpu->coverage);
+    APEX_critical_free(cpu);
+    APEX_mrc_free(cpu);
+    APEX_bpred_free(cpu);
     free(cpu->code_memory);
     free(cpu);
 }
@@ -41,14 +41,64 @@ typedef struct CPU_Stage
     int memory_address;
     int has_insn;
     int stalled;
+    long long seq;                 /* Dynamic instruction number, 0 if not numbered */
+    int enter[NUM_STAGES];         /* Cycle the instruction entered each stage */
 } CPU_Stage;
 
+/* Performance counters of the pipeline, see apex_stats.c */
+typedef struct APEX_Stats
+{
+    long long busy[NUM_STAGES];    /* Cycles a stage passed an instruction on */
+    long long stalled[NUM_STAGES]; /* Cycles a stage held an instruction */
+    long long empty[NUM_STAGES];   /* Cycles a stage had no instruction */
+    long long raw_stalls[NUM_STAGES][REG_FILE_SIZE]; /* By producing stage and source register */
+    long long forwards[NUM_STAGES]; /* Operands forwarded, by producing stage */
+    long long branch_flushes;      /* Taken branches redirecting fetch */
+    long long squashed;            /* Instructions flushed by them */
+    long long retired[NUM_OPCODES];
+    long long cpi_stack[NUM_CPI];  /* Cycles by CPI_* category */
+    int bubble[NUM_STAGES];        /* Why the latch of a stage is empty, CPI_* */
+} APEX_Stats;
+
+/* Instruction latency histograms by opcode, see apex_stats.c */
+typedef struct APEX_Latency
+{
+    long long count[NUM_OPCODES];
+    long long lifetime[NUM_OPCODES][LATENCY_BUCKETS]; /* Fetch to retire */
+    long long lifetime_sum[NUM_OPCODES];
+    long long residency[NUM_OPCODES][NUM_STAGES][LATENCY_BUCKETS]; /* Cycles in each stage */
+    long long residency_sum[NUM_OPCODES][NUM_STAGES];
+} APEX_Latency;
+
+/* Operand reads of decode by opcode, operand and source, see apex_stats.c */
+typedef struct APEX_Coverage
+{
+    long long reads[NUM_OPCODES][NUM_OPERAND_SLOTS][NUM_COVERAGE_SOURCES];
+} APEX_Coverage;
+
+/* Cost table of the energy model, see apex_stats.c */
+typedef struct APEX_Energy
+{
+    double cost[NUM_ENERGY_EVENTS]; /* pJ per ENERGY_* event */
+    double frequency_mhz;
+} APEX_Energy;
+
+/* Per instruction counters of the profiler, see apex_profile.c */
+typedef struct APEX_PC_Profile
+{
+    long long executed;            /* Times retired */
+    long long stall_cycles;        /* Cycles stalled in decode */
+    long long flushes;             /* Taken branches squashing younger instructions */
+    long long forwards;            /* Operands forwarded to it */
+} APEX_PC_Profile;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
     int pc;                        /* Current program counter */
     int clock;                     /* Clock cycles elapsed */
     int insn_completed;            /* Instructions retired */
+    long long insn_fetched;        /* Sequence number of the last instruction fetched */
     int regs[REG_FILE_SIZE];       /* Integer register file */
     int valid_regs[REG_FILE_SIZE];       /* Integer register file indicating register valid bit*/
     int code_memory_size;          /* Number of instruction in the input file */
@@ -57,6 +107,33 @@ typedef struct APEX_CPU
     int single_step;               /* Wait for user input after every cycle */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int fetch_from_next_cycle;
+    struct APEX_CFG *cfg;          /* Control flow graph of code memory */
+    int debug_messages;            /* Print stage contents every cycle */
+    APEX_Stats stats;
+    APEX_PC_Profile *profile;      /* By code memory index, NULL unless profiling */
+    APEX_Latency *latency;         /* NULL unless recording latencies */
+    APEX_Coverage *coverage;       /* NULL unless recording hazard coverage */
+    struct APEX_Critical *critical; /* Dataflow graph, NULL unless analyzing */
+    struct APEX_Mrc *mrc;          /* Miss ratio curves, NULL unless collecting */
+    struct APEX_Bpred *bpred;      /* Branch predictor bank, NULL unless profiling branches */
+    int next_interval;             /* Clock of the next interval row, 0 for none */
+    struct APEX_Interval_Log *intervals;
+    struct APEX_Konata *konata;    /* Pipeline trace, NULL for none */
+    long long chrome_chunk_start;  /* Host ns the current chunk of cycles started, 0 for none */
+    int chrome_chunk_clock;        /* Clock at that time */
+    int next_metrics;              /* Clock of the next metrics snapshot, 0 for none */
+
+    /* Timing only simulation, see apex_memo.c */
+    int timing_only;               /* Pipeline timing without values */
+    /* Describes the instruction in execute: sets its data memory address,
+     * -1 if unknown, and returns 1 for a taken branch, 0 otherwise and -1 if
+     * the source has no record of it */
+    int (*next_record)(void *source, const CPU_Stage *stage, int *memory_address);
+    void *record_source;
+
+    /* Checkpoints, see apex_ckpt.c */
+    int checkpoint_at;             /* Save and stop after this cycle, 0 for never */
+    const char *checkpoint_file;   /* Also saved to when the user quits */
 
     /* Pipeline stages */
     CPU_Stage fetch;
@@ -67,9 +144,120 @@ typedef struct APEX_CPU
 } APEX_CPU;
 
 APEX_Instruction *create_code_memory(const char *filename, int *size);
+void format_instruction(const APEX_Instruction *ins, char *buffer, int size);
+int load_data_memory(const char *filename, int *data_memory);
 APEX_CPU *APEX_cpu_init(const char *filename);
+APEX_CPU *APEX_cpu_init_code(APEX_Instruction *code_memory, int size);
 void APEX_cpu_run(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
 void APEX_cpu_simulate(APEX_CPU *cpu, int c);
 void APEX_cpu_display(APEX_CPU *cpu);
+int APEX_cpu_cycle(APEX_CPU *cpu);
+int print_register_state(APEX_CPU *cpu);
+int print_data_memory(APEX_CPU *cpu);
+
+/* Functional model, see apex_func.c */
+int APEX_func_step(APEX_CPU *cpu);
+int APEX_func_run_block(APEX_CPU *cpu, int max_insns);
+int APEX_func_run(APEX_CPU *cpu, int max_insns);
+int APEX_cpu_functional(APEX_CPU *cpu, int use_jit, int jit_verify);
+
+/* Timing memoization, see apex_memo.c */
+int APEX_cpu_memo(APEX_CPU *cpu, int check);
+
+/* Performance counters, see apex_stats.c */
+int APEX_stats_write_json(const APEX_CPU *cpu, const char *filename);
+void APEX_stats_print_cpi_stack(const APEX_CPU *cpu);
+int APEX_stats_intervals_open(APEX_CPU *cpu, const char *filename, int cycles);
+void APEX_stats_interval(APEX_CPU *cpu);
+int APEX_stats_intervals_close(APEX_CPU *cpu);
+int APEX_stats_latency_enable(APEX_CPU *cpu);
+void APEX_stats_latency_record(APEX_CPU *cpu, const CPU_Stage *stage);
+void APEX_stats_latency_print(const APEX_CPU *cpu);
+int APEX_stats_coverage_enable(APEX_CPU *cpu);
+void APEX_stats_coverage_print(const APEX_CPU *cpu);
+void APEX_stats_energy_defaults(APEX_Energy *energy);
+int APEX_stats_energy_load(APEX_Energy *energy, const char *filename);
+void APEX_stats_energy_print(const APEX_CPU *cpu, const APEX_Energy *energy);
+
+/* Per instruction profiler, see apex_profile.c */
+int APEX_profile_enable(APEX_CPU *cpu);
+void APEX_profile_print(const APEX_CPU *cpu);
+int APEX_profile_write_callgrind(const APEX_CPU *cpu, const char *source,
+                                 const char *filename);
+
+/* Critical path analysis, see apex_critical.c */
+int APEX_critical_enable(APEX_CPU *cpu);
+void APEX_critical_free(APEX_CPU *cpu);
+int APEX_critical_retire(APEX_CPU *cpu, const CPU_Stage *stage);
+void APEX_critical_print(const APEX_CPU *cpu);
+
+/* Miss ratio curves of data memory, see apex_mrc.c */
+int APEX_mrc_enable(APEX_CPU *cpu);
+void APEX_mrc_free(APEX_CPU *cpu);
+void APEX_mrc_access(APEX_CPU *cpu, int address);
+int APEX_mrc_write(const APEX_CPU *cpu, const char *filename);
+
+/* Branch predictor bank, see apex_bpred.c */
+int APEX_bpred_enable(APEX_CPU *cpu);
+void APEX_bpred_free(APEX_CPU *cpu);
+void APEX_bpred_branch(APEX_CPU *cpu, int pc, int imm, int taken);
+void APEX_bpred_print(const APEX_CPU *cpu);
+
+/* Decoupled simulation, see apex_stream.c */
+int APEX_cpu_decoupled(APEX_CPU *cpu);
+
+/* Instruction traces, see apex_trace.c */
+int APEX_trace_record(const APEX_CPU *cpu, const char *filename);
+int APEX_trace_is_trace(const char *filename);
+APEX_CPU *APEX_trace_open(const char *filename);
+int APEX_cpu_replay(APEX_CPU *cpu, const char *filename);
+
+/* Sampled simulation, see apex_sample.c */
+int APEX_cpu_simpoint(APEX_CPU *cpu, int interval, int warmup, int max_k,
+                      const char *bbv_file, int check, int threads);
+int APEX_cpu_smarts(APEX_CPU *cpu, int period, int warmup, int window,
+                    double target_error, int check, int threads);
+
+/* Checkpoints, see apex_ckpt.c */
+int APEX_cpu_checkpoint_save(APEX_CPU *cpu, const char *filename);
+int APEX_cpu_checkpoint_load(APEX_CPU *cpu, const char *filename);
+
+/* Pipeline trace for Konata, see apex_konata.c */
+int APEX_konata_open(APEX_CPU *cpu, const char *filename);
+int APEX_konata_close(APEX_CPU *cpu);
+void APEX_konata_fetch(APEX_CPU *cpu, const CPU_Stage *stage);
+void APEX_konata_stage(APEX_CPU *cpu, const CPU_Stage *stage, const char *name);
+void APEX_konata_stall(APEX_CPU *cpu, const CPU_Stage *stage, int start);
+void APEX_konata_writeback(APEX_CPU *cpu, const CPU_Stage *stage);
+void APEX_konata_flush(APEX_CPU *cpu, const CPU_Stage *stage);
+
+/* Chrome trace of host activity, see apex_chrome.c */
+int APEX_chrome_open(const char *filename, const char *program);
+int APEX_chrome_close(void);
+void APEX_chrome_thread_name(const char *name);
+long long APEX_chrome_begin(void);
+void APEX_chrome_end(const char *name, const char *category, long long start,
+                     const char *args);
+void APEX_chrome_chunk(APEX_CPU *cpu);
+
+/* Live metrics endpoint, see apex_metrics.c */
+int APEX_metrics_start(APEX_CPU *cpu, int port);
+void APEX_metrics_publish(APEX_CPU *cpu, int running);
+
+/* Host self-profile, see apex_host.c */
+#if ENABLE_HOST_PROFILE
+long long APEX_host_time_ns(void);
+void APEX_host_profile_add(int slot, long long ns);
+void APEX_host_profile_print(void);
+#define HOST_PROFILE_BEGIN(slot) long long host_start_##slot = APEX_host_time_ns()
+#define HOST_PROFILE_END(slot) \
+    APEX_host_profile_add(slot, APEX_host_time_ns() - host_start_##slot)
+#else
+#define HOST_PROFILE_BEGIN(slot)
+#define HOST_PROFILE_END(slot)
+#endif
+
+/* Ahead-of-time translation, see apex_aot.c */
+int APEX_cpu_aot(APEX_CPU *cpu, const char *filename, const char *data_file);
 #endif
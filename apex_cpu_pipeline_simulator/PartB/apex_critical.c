@@ -0,0 +1,361 @@
+/*
+ * apex_critical.c
+ * Contains the critical path analysis of a run. The dynamic dataflow graph
+ * is built as instructions retire: every instruction depends on the last
+ * writers of its source registers, a flag reading branch on the last
+ * instruction setting the zero flag, a load on the last store to its data
+ * memory address, and every instruction on the last BZ/BNZ before it.
+ *
+ * With unlimited width, an instruction executes one cycle after its latest
+ * producer, or two if that is a load, so the longest chain is the number of
+ * cycles no pipeline of this depth can beat. It is reported against the
+ * actual cycles, along with the static instructions lying on the chain.
+ *
+ * Each instruction keeps one node with the index of its latest producer, so
+ * the chain can be walked back at the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Result latency in the dataflow graph */
+#define CRITICAL_ALU_LATENCY 1
+#define CRITICAL_LOAD_LATENCY 2
+
+/* Kinds of edges, by which a node depends on its latest producer */
+#define CRITICAL_EDGE_NONE 0x0
+#define CRITICAL_EDGE_REGISTER 0x1
+#define CRITICAL_EDGE_FLAG 0x2
+#define CRITICAL_EDGE_MEMORY 0x3
+#define CRITICAL_EDGE_CONTROL 0x4
+#define NUM_CRITICAL_EDGES 0x5
+
+static const char *const edge_names[NUM_CRITICAL_EDGES] = {
+    "none", "register", "flag", "memory", "control"
+};
+
+/* A dynamic instruction */
+typedef struct APEX_Critical_Node
+{
+    int index;                     /* Code memory index */
+    int pred;                      /* Node of the latest producer, -1 for none */
+    int edge;                      /* CRITICAL_EDGE_* to it */
+} APEX_Critical_Node;
+
+/* Last producer of a register, the zero flag, a data word or control */
+typedef struct APEX_Critical_Def
+{
+    long long ready;               /* Cycle its consumers can execute, 0 if defined before the run */
+    int node;                      /* -1 for none */
+} APEX_Critical_Def;
+
+/* Dataflow graph of the run */
+typedef struct APEX_Critical
+{
+    APEX_Critical_Node *nodes;
+    int num_nodes;
+    int capacity;
+    int last;                      /* Node finishing last */
+    long long length;              /* Its finish cycle */
+    int start_clock;
+    APEX_Critical_Def regs[REG_FILE_SIZE];
+    APEX_Critical_Def flag;
+    APEX_Critical_Def control;
+    APEX_Critical_Def memory[DATA_MEMORY_SIZE];
+} APEX_Critical;
+
+/* Listing entry being sorted */
+typedef struct APEX_Critical_Line
+{
+    int index;
+    long long count;
+} APEX_Critical_Line;
+
+/* Returns TRUE if opcode sets the zero flag */
+static int
+sets_flag(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_ADDL:
+        case OPCODE_SUB:
+        case OPCODE_SUBL:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MOVC:
+        case OPCODE_CMP:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* Makes def the latest producer of the node being added, if it is later */
+static void
+critical_depend(const APEX_Critical_Def *def, int edge, long long *ready,
+                APEX_Critical_Node *node)
+{
+    if (def->node >= 0 && def->ready > *ready)
+    {
+        *ready = def->ready;
+        node->pred = def->node;
+        node->edge = edge;
+    }
+}
+
+/* Starts the analysis of cpu, returns -1 if it can not be allocated */
+int
+APEX_critical_enable(APEX_CPU *cpu)
+{
+    APEX_Critical *critical;
+    int i;
+
+    if (cpu->critical)
+    {
+        return 0;
+    }
+
+    critical = calloc(1, sizeof(APEX_Critical));
+    if (!critical)
+    {
+        return -1;
+    }
+
+    critical->last = -1;
+    critical->start_clock = cpu->clock;
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        critical->regs[i].node = -1;
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        critical->memory[i].node = -1;
+    }
+    critical->flag.node = -1;
+    critical->control.node = -1;
+    cpu->critical = critical;
+    return 0;
+}
+
+/* Frees the analysis of cpu */
+void
+APEX_critical_free(APEX_CPU *cpu)
+{
+    if (cpu->critical)
+    {
+        free(cpu->critical->nodes);
+        free(cpu->critical);
+        cpu->critical = NULL;
+    }
+}
+
+/*
+ * Adds the instruction in stage, which is being written back, to the graph.
+ * Returns -1, and stops the analysis, if the graph can not grow.
+ */
+int
+APEX_critical_retire(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Critical *critical = cpu->critical;
+    APEX_Critical_Node *node;
+    APEX_Critical_Node *nodes;
+    int opcode = stage->opcode;
+    int address = stage->memory_address;
+    int has_address;
+    long long ready = 0;
+    long long finish;
+    int capacity;
+    int n;
+
+    if (critical->num_nodes == critical->capacity)
+    {
+        capacity = critical->capacity ? 2 * critical->capacity : 4096;
+        nodes = realloc(critical->nodes, capacity * sizeof(APEX_Critical_Node));
+        if (!nodes)
+        {
+            fprintf(stderr, "APEX_Error: Critical path graph too large, analysis stopped\n");
+            APEX_critical_free(cpu);
+            return -1;
+        }
+        critical->nodes = nodes;
+        critical->capacity = capacity;
+    }
+
+    n = critical->num_nodes++;
+    node = &critical->nodes[n];
+    node->index = (stage->pc - 4000) / 4;
+    node->pred = -1;
+    node->edge = CRITICAL_EDGE_NONE;
+
+    /* Source registers, as decode reads them */
+    switch (opcode)
+    {
+        case OPCODE_STR:
+            critical_depend(&critical->regs[stage->rs3], CRITICAL_EDGE_REGISTER,
+                            &ready, node);
+            /* Fall through */
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_LDR:
+        case OPCODE_CMP:
+        case OPCODE_STORE:
+            critical_depend(&critical->regs[stage->rs2], CRITICAL_EDGE_REGISTER,
+                            &ready, node);
+            /* Fall through */
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+            critical_depend(&critical->regs[stage->rs1], CRITICAL_EDGE_REGISTER,
+                            &ready, node);
+            break;
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+            critical_depend(&critical->flag, CRITICAL_EDGE_FLAG, &ready, node);
+            break;
+
+        default:
+            break;
+    }
+
+    /* A timing only cpu has the addresses its record source gave, -1 if
+     * it had none */
+    has_address = address >= 0 && address < DATA_MEMORY_SIZE;
+    if (has_address && (opcode == OPCODE_LOAD || opcode == OPCODE_LDR))
+    {
+        critical_depend(&critical->memory[address], CRITICAL_EDGE_MEMORY,
+                        &ready, node);
+    }
+    critical_depend(&critical->control, CRITICAL_EDGE_CONTROL, &ready, node);
+
+    finish = ready + (opcode == OPCODE_LOAD || opcode == OPCODE_LDR
+                      ? CRITICAL_LOAD_LATENCY : CRITICAL_ALU_LATENCY);
+    if (finish > critical->length)
+    {
+        critical->length = finish;
+        critical->last = n;
+    }
+
+    /* This instruction is now the latest producer of what it writes, decode
+     * sets rd to -1 for instructions not writing a register */
+    if (stage->rd >= 0 && stage->rd < REG_FILE_SIZE)
+    {
+        critical->regs[stage->rd].ready = finish;
+        critical->regs[stage->rd].node = n;
+    }
+    if (sets_flag(opcode))
+    {
+        critical->flag.ready = finish;
+        critical->flag.node = n;
+    }
+    if (has_address && (opcode == OPCODE_STORE || opcode == OPCODE_STR))
+    {
+        critical->memory[address].ready = finish;
+        critical->memory[address].node = n;
+    }
+    if (opcode == OPCODE_BZ || opcode == OPCODE_BNZ)
+    {
+        critical->control.ready = finish;
+        critical->control.node = n;
+    }
+    return 0;
+}
+
+/* Orders by count, most frequent first, then by address */
+static int
+critical_compare(const void *a, const void *b)
+{
+    const APEX_Critical_Line *x = a, *y = b;
+
+    if (x->count != y->count)
+    {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+/*
+ * Prints the critical path length against the cycles the run took, the
+ * edges it is made of, and the static instructions on it, most frequent
+ * first.
+ */
+void
+APEX_critical_print(const APEX_CPU *cpu)
+{
+    const APEX_Critical *critical = cpu->critical;
+    APEX_Critical_Line *lines;
+    long long edges[NUM_CRITICAL_EDGES] = {0};
+    long long on_path = 0;
+    long long bound;
+    int cycles;
+    char text[64];
+    int i, n;
+
+    if (!critical)
+    {
+        return;
+    }
+
+    lines = calloc(cpu->code_memory_size ? cpu->code_memory_size : 1,
+                   sizeof(APEX_Critical_Line));
+    if (!lines)
+    {
+        return;
+    }
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        lines[i].index = i;
+    }
+    for (n = critical->last; n >= 0; n = critical->nodes[n].pred)
+    {
+        if (critical->nodes[n].index >= 0
+            && critical->nodes[n].index < cpu->code_memory_size)
+        {
+            lines[critical->nodes[n].index].count++;
+        }
+        edges[critical->nodes[n].edge]++;
+        on_path++;
+    }
+    qsort(lines, cpu->code_memory_size, sizeof(APEX_Critical_Line),
+          critical_compare);
+
+    /* The first instruction still goes through the stages before execute
+     * and the last one through those after it */
+    bound = critical->length ? critical->length + NUM_STAGES - 1 : 0;
+    cycles = cpu->clock - critical->start_clock;
+    printf("APEX_CRITICAL: %d instructions, critical path %lld instructions, %lld cycles\n",
+           critical->num_nodes, on_path, critical->length);
+    printf("APEX_CRITICAL: dataflow bound %lld cycles, actual %d cycles (%.2fx the bound)\n",
+           bound, cycles, bound ? (double)cycles / bound : 0.0);
+    printf("APEX_CRITICAL: path edges:");
+    for (i = CRITICAL_EDGE_REGISTER; i < NUM_CRITICAL_EDGES; ++i)
+    {
+        printf(" %s %lld", edge_names[i], edges[i]);
+    }
+    printf("\n");
+
+    printf("APEX_CRITICAL: %6s %10s %7s  %s\n", "pc", "on_path", "share",
+           "instruction");
+    for (i = 0; i < cpu->code_memory_size && lines[i].count; ++i)
+    {
+        format_instruction(&cpu->code_memory[lines[i].index], text,
+                           sizeof(text));
+        printf("APEX_CRITICAL: %6d %10lld %6.2f%%  %s\n",
+               4000 + 4 * lines[i].index, lines[i].count,
+               100.0 * lines[i].count / on_path, text);
+    }
+    free(lines);
+}
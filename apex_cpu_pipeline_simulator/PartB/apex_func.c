@@ -0,0 +1,387 @@
+/*
+ * apex_func.c
+ * Contains the functional (instruction level) model of the APEX cpu. It
+ * executes one instruction at a time on the architectural state of the cpu
+ * (pc, registers, zero flag and data memory) without modelling the pipeline.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cfg.h"
+#include "apex_cpu.h"
+#include "apex_jit.h"
+#include "apex_macros.h"
+
+/* Converts the PC(4000 series) into array index for code memory */
+static int
+get_code_memory_index_from_pc(const int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+/* Arithmetic is done on unsigned values so that overflow wraps around
+ * instead of being undefined, the same way the host instructions do */
+static void
+set_result(APEX_CPU *cpu, int rd, unsigned int result)
+{
+    cpu->regs[rd] = (int)result;
+
+    /* Set the zero flag based on the result */
+    if (result == 0)
+    {
+        cpu->zero_flag = TRUE;
+    }
+    else
+    {
+        cpu->zero_flag = FALSE;
+    }
+}
+
+static int
+check_data_address(const APEX_CPU *cpu, int address)
+{
+    if (address < 0 || address >= DATA_MEMORY_SIZE)
+    {
+        fprintf(stderr, "APEX_Error: Data memory address %d out of range at pc(%d)\n",
+                address, cpu->pc);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int
+check_pc(const APEX_CPU *cpu)
+{
+    if (cpu->pc < 4000 || (cpu->pc - 4000) % 4 != 0
+        || get_code_memory_index_from_pc(cpu->pc) >= cpu->code_memory_size)
+    {
+        fprintf(stderr, "APEX_Error: PC %d outside of code memory\n", cpu->pc);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Executes ins, which must be the instruction at cpu->pc */
+static int
+func_execute(APEX_CPU *cpu, const APEX_Instruction *ins)
+{
+    unsigned int rs1, rs2;
+    int address;
+
+    rs1 = (unsigned int)cpu->regs[ins->rs1];
+    rs2 = (unsigned int)cpu->regs[ins->rs2];
+
+    switch (ins->opcode)
+    {
+        case OPCODE_ADD:
+        {
+            set_result(cpu, ins->rd, rs1 + rs2);
+            break;
+        }
+
+        case OPCODE_ADDL:
+        {
+            set_result(cpu, ins->rd, rs1 + (unsigned int)ins->imm);
+            break;
+        }
+
+        case OPCODE_SUB:
+        {
+            set_result(cpu, ins->rd, rs1 - rs2);
+            break;
+        }
+
+        case OPCODE_SUBL:
+        {
+            set_result(cpu, ins->rd, rs1 - (unsigned int)ins->imm);
+            break;
+        }
+
+        case OPCODE_MUL:
+        {
+            set_result(cpu, ins->rd, rs1 * rs2);
+            break;
+        }
+
+        case OPCODE_DIV:
+        {
+            if (rs2 == (unsigned int)-1)
+            {
+                /* INT_MIN / -1 overflows the host division */
+                set_result(cpu, ins->rd, 0u - rs1);
+            }
+            else if (rs2 != 0)
+            {
+                set_result(cpu, ins->rd,
+                           (unsigned int)((int)rs1 / (int)rs2));
+            }
+            else
+            {
+                fprintf(stderr, "Division By Zero Returning Value Zero\n");
+                set_result(cpu, ins->rd, 0);
+            }
+            break;
+        }
+
+        case OPCODE_AND:
+        {
+            set_result(cpu, ins->rd, rs1 & rs2);
+            break;
+        }
+
+        case OPCODE_OR:
+        {
+            set_result(cpu, ins->rd, rs1 | rs2);
+            break;
+        }
+
+        case OPCODE_XOR:
+        {
+            set_result(cpu, ins->rd, rs1 ^ rs2);
+            break;
+        }
+
+        case OPCODE_MOVC:
+        {
+            set_result(cpu, ins->rd, (unsigned int)ins->imm);
+            break;
+        }
+
+        case OPCODE_CMP:
+        {
+            /* CMP only updates the zero flag */
+            cpu->zero_flag = (rs1 == rs2) ? TRUE : FALSE;
+            break;
+        }
+
+        case OPCODE_LOAD:
+        {
+            address = (int)(rs1 + (unsigned int)ins->imm);
+            if (!check_data_address(cpu, address))
+            {
+                return APEX_FUNC_ERROR;
+            }
+            cpu->regs[ins->rd] = cpu->data_memory[address];
+            break;
+        }
+
+        case OPCODE_LDR:
+        {
+            address = (int)(rs1 + rs2);
+            if (!check_data_address(cpu, address))
+            {
+                return APEX_FUNC_ERROR;
+            }
+            cpu->regs[ins->rd] = cpu->data_memory[address];
+            break;
+        }
+
+        case OPCODE_STORE:
+        {
+            address = (int)(rs2 + (unsigned int)ins->imm);
+            if (!check_data_address(cpu, address))
+            {
+                return APEX_FUNC_ERROR;
+            }
+            cpu->data_memory[address] = (int)rs1;
+            break;
+        }
+
+        case OPCODE_STR:
+        {
+            address = (int)(rs2 + (unsigned int)cpu->regs[ins->rs3]);
+            if (!check_data_address(cpu, address))
+            {
+                return APEX_FUNC_ERROR;
+            }
+            cpu->data_memory[address] = (int)rs1;
+            break;
+        }
+
+        case OPCODE_BZ:
+        {
+            cpu->insn_completed++;
+            if (cpu->zero_flag == TRUE)
+            {
+                cpu->pc += ins->imm;
+            }
+            else
+            {
+                cpu->pc += 4;
+            }
+            return APEX_FUNC_OK;
+        }
+
+        case OPCODE_BNZ:
+        {
+            cpu->insn_completed++;
+            if (cpu->zero_flag == FALSE)
+            {
+                cpu->pc += ins->imm;
+            }
+            else
+            {
+                cpu->pc += 4;
+            }
+            return APEX_FUNC_OK;
+        }
+
+        case OPCODE_HALT:
+        {
+            /* The pc stays on the HALT instruction */
+            cpu->insn_completed++;
+            return APEX_FUNC_HALT;
+        }
+
+        case OPCODE_NOP:
+        default:
+        {
+            break;
+        }
+    }
+
+    cpu->insn_completed++;
+    cpu->pc += 4;
+    return APEX_FUNC_OK;
+}
+
+/*
+ * Executes the instruction at cpu->pc and advances the pc
+ *
+ * Returns APEX_FUNC_HALT once HALT has been executed and APEX_FUNC_ERROR if
+ * the pc or a data memory address falls outside of memory.
+ */
+int
+APEX_func_step(APEX_CPU *cpu)
+{
+    if (!check_pc(cpu))
+    {
+        return APEX_FUNC_ERROR;
+    }
+
+    return func_execute(cpu,
+                        &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)]);
+}
+
+/*
+ * Executes the rest of the basic block starting at cpu->pc, at most
+ * max_insns instructions of it if max_insns is not negative. Branch targets
+ * were validated when the CFG was built, so the pc is only checked on entry.
+ */
+int
+APEX_func_run_block(APEX_CPU *cpu, int max_insns)
+{
+    const APEX_Instruction *ins, *last;
+    int index, status;
+
+    if (!cpu->cfg)
+    {
+        return APEX_func_step(cpu);
+    }
+
+    if (!check_pc(cpu))
+    {
+        return APEX_FUNC_ERROR;
+    }
+
+    index = get_code_memory_index_from_pc(cpu->pc);
+    ins = &cpu->code_memory[index];
+    last = &cpu->code_memory[cpu->cfg->blocks[cpu->cfg->block_of[index]].end];
+    if (max_insns >= 0 && last - ins >= max_insns)
+    {
+        last = ins + max_insns - 1;
+    }
+
+    for (; ins <= last; ++ins)
+    {
+        status = func_execute(cpu, ins);
+        if (status != APEX_FUNC_OK)
+        {
+            return status;
+        }
+    }
+    return APEX_FUNC_OK;
+}
+
+/*
+ * Executes instructions until HALT, an error, or until max_insns
+ * instructions have been executed. A negative max_insns means no limit.
+ */
+int
+APEX_func_run(APEX_CPU *cpu, int max_insns)
+{
+    int status = APEX_FUNC_OK;
+    int start;
+
+    while (max_insns != 0)
+    {
+        start = cpu->insn_completed;
+        status = APEX_func_run_block(cpu, max_insns);
+        if (status != APEX_FUNC_OK)
+        {
+            break;
+        }
+
+        if (max_insns > 0)
+        {
+            max_insns -= cpu->insn_completed - start;
+        }
+    }
+    return status;
+}
+
+/*
+ * Runs the whole program on the functional model, optionally through the
+ * x86-64 JIT, and prints the final architectural state. Returns 0 on success
+ * and 1 if the program did not reach HALT.
+ */
+int
+APEX_cpu_functional(APEX_CPU *cpu, int use_jit, int jit_verify)
+{
+    APEX_JIT *jit = NULL;
+    int status;
+
+    if (use_jit)
+    {
+        jit = APEX_jit_create(cpu->code_memory, cpu->code_memory_size);
+        if (!jit)
+        {
+            fprintf(stderr, "APEX_JIT: JIT not available, using interpreter\n");
+        }
+    }
+
+    if (jit && jit_verify)
+    {
+        status = APEX_jit_verify(jit, cpu);
+    }
+    else if (jit)
+    {
+        status = APEX_jit_run(jit, cpu, -1);
+    }
+    else
+    {
+        status = APEX_func_run(cpu, -1);
+    }
+
+    if (status == APEX_FUNC_HALT)
+    {
+        printf("APEX_CPU: Functional Simulation Complete, instructions = %d\n",
+               cpu->insn_completed);
+    }
+    else
+    {
+        printf("APEX_CPU: Functional Simulation Stopped, pc = %d instructions = %d\n",
+               cpu->pc, cpu->insn_completed);
+    }
+
+    if (jit)
+    {
+        APEX_jit_print_stats(jit);
+        APEX_jit_destroy(jit);
+    }
+
+    print_register_state(cpu);
+    print_data_memory(cpu);
+    return status == APEX_FUNC_HALT ? 0 : 1;
+}
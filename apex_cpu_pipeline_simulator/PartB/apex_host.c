@@ -0,0 +1,104 @@
+/*
+ * apex_host.c
+ * Contains the host self-profile of the simulator, enabled with
+ * ENABLE_HOST_PROFILE in apex_macros.h. The stage functions and the output
+ * routines are timed with clock_gettime around every call, and the times
+ * are kept in power of two nanosecond histograms per slot which are printed
+ * when the cpu is stopped. With the flag off this file and the
+ * HOST_PROFILE_BEGIN/END markers compile to nothing.
+ *
+ * The histograms are per thread, worker threads of the sampled simulations
+ * are not included.
+ */
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#if ENABLE_HOST_PROFILE
+
+#include <stdio.h>
+#include <time.h>
+
+/* Bucket b holds calls taking [2^b, 2^(b+1)) ns, the last one all longer */
+#define HOST_BUCKETS 24
+
+typedef struct APEX_Host_Slot
+{
+    long long calls;
+    long long total_ns;
+    long long buckets[HOST_BUCKETS];
+} APEX_Host_Slot;
+
+static _Thread_local APEX_Host_Slot host_slots[NUM_HOST_SLOTS];
+
+static const char *const host_slot_names[NUM_HOST_SLOTS] = {
+    "fetch", "decode", "execute", "memory", "writeback", "output"
+};
+
+/* Returns the host monotonic time in ns */
+long long
+APEX_host_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Adds a call of ns to slot */
+void
+APEX_host_profile_add(int slot, long long ns)
+{
+    APEX_Host_Slot *host = &host_slots[slot];
+    int b = 0;
+
+    while (b < HOST_BUCKETS - 1 && (ns >> (b + 1)) > 0)
+    {
+        b++;
+    }
+    host->calls++;
+    host->total_ns += ns;
+    host->buckets[b]++;
+}
+
+/*
+ * Prints the calls, total and mean time of every slot and its histogram.
+ * The stages run once per simulated cycle, so their mean is ns per cycle.
+ */
+void
+APEX_host_profile_print(void)
+{
+    const APEX_Host_Slot *host;
+    int slot, b;
+
+    printf("APEX_HOST: %-10s %12s %12s %10s\n", "slot", "calls", "total_ms",
+           "ns/call");
+    for (slot = 0; slot < NUM_HOST_SLOTS; ++slot)
+    {
+        host = &host_slots[slot];
+        printf("APEX_HOST: %-10s %12lld %12.3f %10.1f\n",
+               host_slot_names[slot], host->calls, host->total_ns / 1e6,
+               host->calls ? (double)host->total_ns / host->calls : 0.0);
+    }
+
+    for (slot = 0; slot < NUM_HOST_SLOTS; ++slot)
+    {
+        host = &host_slots[slot];
+        if (!host->calls)
+        {
+            continue;
+        }
+
+        printf("APEX_HOST: %-10s ns histogram:", host_slot_names[slot]);
+        for (b = 0; b < HOST_BUCKETS; ++b)
+        {
+            if (host->buckets[b])
+            {
+                printf(" %s%lld:%lld", b == HOST_BUCKETS - 1 ? ">=" : "",
+                       1LL << b, host->buckets[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+#endif
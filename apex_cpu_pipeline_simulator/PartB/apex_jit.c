@@ -0,0 +1,825 @@
+/*
+ * apex_jit.c
+ * Contains a basic block JIT which translates APEX code memory into x86-64
+ * host code for the functional model.
+ *
+ * Register usage inside translated code:
+ *   rdi        - APEX_JIT_State of the running program
+ *   rsi        - base of APEX data memory
+ *   rbp        - instructions retired so far (state->insn_count)
+ *   ebx        - APEX zero flag
+ *   r8d-r15d   - APEX registers R0-R7, R8-R15 stay in state->regs
+ *   eax, ecx   - scratch
+ *
+ * A block ends at BZ/BNZ, at an instruction which is not supported by the
+ * translator (DIV and HALT are left to the interpreter) or after
+ * JIT_MAX_BLOCK_INSNS instructions. Every block starts with a check against
+ * state->insn_limit, so chained blocks always return to the dispatcher in
+ * time for lock-step verification and for exact instruction limits.
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_jit.h"
+#include "apex_macros.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+/* Host register numbers as encoded in ModRM */
+#define HOST_EAX 0
+#define HOST_ECX 1
+#define HOST_EBX 3
+
+/* APEX registers below this number are held in host registers r8d-r15d */
+#define JIT_NUM_HOST_REGS 8
+
+/* Size of a block exit sequence in bytes, see emit_exit() */
+#define JIT_EXIT_SIZE 22
+
+/* Worst case host bytes per APEX instruction plus block entry/exit */
+#define JIT_MAX_INSN_BYTES 64
+
+#define STATE_OFFSET(field) ((int)offsetof(APEX_JIT_State, field))
+
+/* Converts the PC(4000 series) into array index for code memory */
+static int
+get_code_memory_index_from_pc(const int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+static int
+get_pc_from_code_memory_index(const int index)
+{
+    return 4000 + index * 4;
+}
+
+/* Returns the code memory index for pc, or -1 if pc is not in code memory */
+static int
+jit_index_from_pc(const APEX_JIT *jit, int pc)
+{
+    int index = get_code_memory_index_from_pc(pc);
+
+    if (pc < 4000 || (pc - 4000) % 4 != 0 || index >= jit->code_memory_size)
+    {
+        return -1;
+    }
+    return index;
+}
+
+#if defined(__x86_64__)
+
+static void
+emit_byte(APEX_JIT *jit, unsigned char byte)
+{
+    jit->code[jit->code_used++] = byte;
+}
+
+static void
+emit_u32(APEX_JIT *jit, unsigned int value)
+{
+    memcpy(jit->code + jit->code_used, &value, sizeof(value));
+    jit->code_used += sizeof(value);
+}
+
+static void
+emit_bytes(APEX_JIT *jit, const unsigned char *bytes, size_t len)
+{
+    memcpy(jit->code + jit->code_used, bytes, len);
+    jit->code_used += len;
+}
+
+/* Points the rel32 at offset patch_offset to dest */
+static void
+patch_rel32(APEX_JIT *jit, size_t patch_offset, const unsigned char *dest)
+{
+    int rel = (int)(dest - (jit->code + patch_offset + 4));
+
+    memcpy(jit->code + patch_offset, &rel, sizeof(rel));
+}
+
+static int
+host_reg_of(int apex_reg)
+{
+    if (apex_reg < JIT_NUM_HOST_REGS)
+    {
+        return 8 + apex_reg;
+    }
+    return -1;
+}
+
+/* mov dst32, src32 */
+static void
+emit_mov_reg_reg(APEX_JIT *jit, int dst, int src)
+{
+    unsigned char rex = 0x40 | ((src >= 8) ? 0x4 : 0) | ((dst >= 8) ? 0x1 : 0);
+
+    if (rex != 0x40)
+    {
+        emit_byte(jit, rex);
+    }
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+/* 32 bit load (0x8B) or store (0x89) between reg and [rdi + disp32] */
+static void
+emit_state_access(APEX_JIT *jit, unsigned char op, int reg, int disp)
+{
+    if (reg >= 8)
+    {
+        emit_byte(jit, 0x44);
+    }
+    emit_byte(jit, op);
+    emit_byte(jit, 0x80 | ((reg & 7) << 3) | 7);
+    emit_u32(jit, (unsigned int)disp);
+}
+
+/* Loads APEX register apex_reg into host scratch register host */
+static void
+emit_load_apex(APEX_JIT *jit, int host, int apex_reg)
+{
+    int mapped = host_reg_of(apex_reg);
+
+    if (mapped >= 0)
+    {
+        emit_mov_reg_reg(jit, host, mapped);
+    }
+    else
+    {
+        emit_state_access(jit, 0x8B, host, STATE_OFFSET(regs) + 4 * apex_reg);
+    }
+}
+
+/* Stores host scratch register host into APEX register apex_reg */
+static void
+emit_store_apex(APEX_JIT *jit, int apex_reg, int host)
+{
+    int mapped = host_reg_of(apex_reg);
+
+    if (mapped >= 0)
+    {
+        emit_mov_reg_reg(jit, mapped, host);
+    }
+    else
+    {
+        emit_state_access(jit, 0x89, host, STATE_OFFSET(regs) + 4 * apex_reg);
+    }
+}
+
+/* ebx = (eax == 0) */
+static void
+emit_zero_flag_from_eax(APEX_JIT *jit)
+{
+    static const unsigned char seq[] = {
+        0x31, 0xDB,             /* xor ebx, ebx */
+        0x85, 0xC0,             /* test eax, eax */
+        0x0F, 0x94, 0xC3        /* sete bl */
+    };
+
+    emit_bytes(jit, seq, sizeof(seq));
+}
+
+/* add eax, imm32 */
+static void
+emit_add_eax_imm(APEX_JIT *jit, int imm)
+{
+    emit_byte(jit, 0x05);
+    emit_u32(jit, (unsigned int)imm);
+}
+
+/*
+ * Leaves the block with n more instructions retired and pc as the next pc.
+ * Returns the offset of the rel32 of the final jmp, which initially points
+ * at the exit stub.
+ */
+static size_t
+emit_exit(APEX_JIT *jit, int n, int pc)
+{
+    size_t patch_offset;
+
+    /* add rbp, n */
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x81);
+    emit_byte(jit, 0xC5);
+    emit_u32(jit, (unsigned int)n);
+
+    /* mov dword [rdi + pc], pc */
+    emit_byte(jit, 0xC7);
+    emit_byte(jit, 0x87);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(pc));
+    emit_u32(jit, (unsigned int)pc);
+
+    /* jmp exit_stub */
+    emit_byte(jit, 0xE9);
+    patch_offset = jit->code_used;
+    emit_u32(jit, 0);
+    patch_rel32(jit, patch_offset, jit->exit_stub);
+    return patch_offset;
+}
+
+/* Block exit which gets chained to the block at pc once it exists */
+static void
+emit_chained_exit(APEX_JIT *jit, int n, int pc)
+{
+    size_t patch_offset = emit_exit(jit, n, pc);
+    int index = jit_index_from_pc(jit, pc);
+
+    if (index < 0)
+    {
+        return;
+    }
+
+    if (jit->block[index])
+    {
+        patch_rel32(jit, patch_offset, jit->block[index]);
+        jit->blocks_chained++;
+        return;
+    }
+
+    if (jit->num_exits == jit->max_exits)
+    {
+        jit->max_exits = jit->max_exits ? 2 * jit->max_exits : 256;
+        jit->exits = realloc(jit->exits, jit->max_exits * sizeof(APEX_JIT_Exit));
+    }
+    jit->exits[jit->num_exits].patch_offset = patch_offset;
+    jit->exits[jit->num_exits].target_index = index;
+    jit->num_exits++;
+}
+
+/* Leaves the block through the interpreter unless 0 <= eax < DATA_MEMORY_SIZE */
+static void
+emit_bounds_check(APEX_JIT *jit, int n, int pc)
+{
+    /* cmp eax, DATA_MEMORY_SIZE */
+    emit_byte(jit, 0x3D);
+    emit_u32(jit, DATA_MEMORY_SIZE);
+
+    /* jb over the exit */
+    emit_byte(jit, 0x72);
+    emit_byte(jit, JIT_EXIT_SIZE);
+    emit_exit(jit, n, pc);
+}
+
+/* Emits the trampoline used to enter translated code and the common exit
+ * stub at the start of the code cache */
+static void
+emit_trampolines(APEX_JIT *jit)
+{
+    static const unsigned char save[] = {
+        0x53, 0x55,             /* push rbx; push rbp */
+        0x41, 0x54, 0x41, 0x55, /* push r12; push r13 */
+        0x41, 0x56, 0x41, 0x57, /* push r14; push r15 */
+        0x48, 0x89, 0xF0        /* mov rax, rsi */
+    };
+    static const unsigned char restore[] = {
+        0x41, 0x5F, 0x41, 0x5E, /* pop r15; pop r14 */
+        0x41, 0x5D, 0x41, 0x5C, /* pop r13; pop r12 */
+        0x5D, 0x5B,             /* pop rbp; pop rbx */
+        0xC3                    /* ret */
+    };
+    int i;
+
+    /* enter(state, block) */
+    jit->code_used = 0;
+    emit_bytes(jit, save, sizeof(save));
+
+    /* mov rsi, [rdi + data_memory]; mov rbp, [rdi + insn_count] */
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x8B);
+    emit_byte(jit, 0xB7);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(data_memory));
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x8B);
+    emit_byte(jit, 0xAF);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(insn_count));
+
+    emit_state_access(jit, 0x8B, HOST_EBX, STATE_OFFSET(zero_flag));
+    for (i = 0; i < JIT_NUM_HOST_REGS; ++i)
+    {
+        emit_state_access(jit, 0x8B, host_reg_of(i), STATE_OFFSET(regs) + 4 * i);
+    }
+
+    /* jmp rax */
+    emit_byte(jit, 0xFF);
+    emit_byte(jit, 0xE0);
+
+    /* Exit stub, writes the host registers back to the state */
+    jit->exit_stub = jit->code + jit->code_used;
+    for (i = 0; i < JIT_NUM_HOST_REGS; ++i)
+    {
+        emit_state_access(jit, 0x89, host_reg_of(i), STATE_OFFSET(regs) + 4 * i);
+    }
+    emit_state_access(jit, 0x89, HOST_EBX, STATE_OFFSET(zero_flag));
+
+    /* mov [rdi + insn_count], rbp */
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xAF);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(insn_count));
+    emit_bytes(jit, restore, sizeof(restore));
+
+    jit->code_reset = jit->code_used;
+}
+
+/* Drops every translation, used when the cache fills up */
+static void
+jit_flush(APEX_JIT *jit)
+{
+    jit->code_used = jit->code_reset;
+    memset(jit->block, 0, jit->code_memory_size * sizeof(unsigned char *));
+    memset(jit->no_block, 0, jit->code_memory_size);
+    jit->num_exits = 0;
+    jit->flushes++;
+}
+
+static int
+jit_insn_supported(const APEX_Instruction *ins)
+{
+    switch (ins->opcode)
+    {
+        case OPCODE_DIV:
+        case OPCODE_HALT:
+        {
+            return FALSE;
+        }
+
+        default:
+        {
+            return ins->opcode <= OPCODE_NOP;
+        }
+    }
+}
+
+/* Translates the basic block starting at code memory index start */
+static unsigned char *
+jit_translate(APEX_JIT *jit, int start)
+{
+    const APEX_Instruction *ins;
+    unsigned char *entry;
+    int i, n, pc, len;
+
+    if (!jit_insn_supported(&jit->code_memory[start]))
+    {
+        jit->no_block[start] = TRUE;
+        return NULL;
+    }
+
+    if (jit->code_used + (JIT_MAX_BLOCK_INSNS + 2) * JIT_MAX_INSN_BYTES
+        > JIT_CODE_CACHE_SIZE)
+    {
+        jit_flush(jit);
+    }
+
+    /* Number of instructions the block may retire, for the entry check */
+    for (len = 0; start + len < jit->code_memory_size && len < JIT_MAX_BLOCK_INSNS;)
+    {
+        ins = &jit->code_memory[start + len];
+        if (!jit_insn_supported(ins))
+        {
+            break;
+        }
+        len++;
+        if (ins->opcode == OPCODE_BZ || ins->opcode == OPCODE_BNZ)
+        {
+            break;
+        }
+    }
+
+    entry = jit->code + jit->code_used;
+
+    /* lea rax, [rbp + len]; cmp rax, [rdi + insn_limit]; jle body */
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x8D);
+    emit_byte(jit, 0x85);
+    emit_u32(jit, (unsigned int)len);
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x3B);
+    emit_byte(jit, 0x87);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(insn_limit));
+    emit_byte(jit, 0x7E);
+    emit_byte(jit, 15);
+
+    /* mov dword [rdi + pc], start pc; jmp exit_stub (15 bytes) */
+    emit_byte(jit, 0xC7);
+    emit_byte(jit, 0x87);
+    emit_u32(jit, (unsigned int)STATE_OFFSET(pc));
+    emit_u32(jit, (unsigned int)get_pc_from_code_memory_index(start));
+    emit_byte(jit, 0xE9);
+    emit_u32(jit, 0);
+    patch_rel32(jit, jit->code_used - 4, jit->exit_stub);
+
+    for (i = start, n = 0; n < len; ++i, ++n)
+    {
+        ins = &jit->code_memory[i];
+        pc = get_pc_from_code_memory_index(i);
+
+        switch (ins->opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            {
+                emit_load_apex(jit, HOST_EAX, ins->rs1);
+                emit_load_apex(jit, HOST_ECX, ins->rs2);
+                switch (ins->opcode)
+                {
+                    case OPCODE_ADD: emit_byte(jit, 0x03); break;
+                    case OPCODE_SUB: emit_byte(jit, 0x2B); break;
+                    case OPCODE_AND: emit_byte(jit, 0x23); break;
+                    case OPCODE_OR: emit_byte(jit, 0x0B); break;
+                    case OPCODE_XOR: emit_byte(jit, 0x33); break;
+                    default:
+                    {
+                        /* imul eax, ecx */
+                        emit_byte(jit, 0x0F);
+                        emit_byte(jit, 0xAF);
+                        break;
+                    }
+                }
+                emit_byte(jit, 0xC1);
+                emit_store_apex(jit, ins->rd, HOST_EAX);
+                emit_zero_flag_from_eax(jit);
+                break;
+            }
+
+            case OPCODE_ADDL:
+            case OPCODE_SUBL:
+            {
+                emit_load_apex(jit, HOST_EAX, ins->rs1);
+                emit_add_eax_imm(jit, (ins->opcode == OPCODE_ADDL) ? ins->imm
+                                                                   : -ins->imm);
+                emit_store_apex(jit, ins->rd, HOST_EAX);
+                emit_zero_flag_from_eax(jit);
+                break;
+            }
+
+            case OPCODE_MOVC:
+            {
+                /* mov eax, imm; mov ebx, (imm == 0) */
+                emit_byte(jit, 0xB8);
+                emit_u32(jit, (unsigned int)ins->imm);
+                emit_store_apex(jit, ins->rd, HOST_EAX);
+                emit_byte(jit, 0xBB);
+                emit_u32(jit, (ins->imm == 0) ? TRUE : FALSE);
+                break;
+            }
+
+            case OPCODE_CMP:
+            {
+                /* sub eax, ecx only to set the zero flag */
+                emit_load_apex(jit, HOST_EAX, ins->rs1);
+                emit_load_apex(jit, HOST_ECX, ins->rs2);
+                emit_byte(jit, 0x2B);
+                emit_byte(jit, 0xC1);
+                emit_zero_flag_from_eax(jit);
+                break;
+            }
+
+            case OPCODE_LOAD:
+            case OPCODE_LDR:
+            {
+                emit_load_apex(jit, HOST_EAX, ins->rs1);
+                if (ins->opcode == OPCODE_LOAD)
+                {
+                    emit_add_eax_imm(jit, ins->imm);
+                }
+                else
+                {
+                    /* add eax, ecx */
+                    emit_load_apex(jit, HOST_ECX, ins->rs2);
+                    emit_byte(jit, 0x03);
+                    emit_byte(jit, 0xC1);
+                }
+                emit_bounds_check(jit, n, pc);
+
+                /* mov ecx, [rsi + rax * 4] */
+                emit_byte(jit, 0x8B);
+                emit_byte(jit, 0x0C);
+                emit_byte(jit, 0x86);
+                emit_store_apex(jit, ins->rd, HOST_ECX);
+                break;
+            }
+
+            case OPCODE_STORE:
+            case OPCODE_STR:
+            {
+                emit_load_apex(jit, HOST_EAX, ins->rs2);
+                if (ins->opcode == OPCODE_STORE)
+                {
+                    emit_add_eax_imm(jit, ins->imm);
+                }
+                else
+                {
+                    /* add eax, ecx */
+                    emit_load_apex(jit, HOST_ECX, ins->rs3);
+                    emit_byte(jit, 0x03);
+                    emit_byte(jit, 0xC1);
+                }
+                emit_bounds_check(jit, n, pc);
+
+                /* mov [rsi + rax * 4], ecx */
+                emit_load_apex(jit, HOST_ECX, ins->rs1);
+                emit_byte(jit, 0x89);
+                emit_byte(jit, 0x0C);
+                emit_byte(jit, 0x86);
+                break;
+            }
+
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            {
+                /* test ebx, ebx; jnz/jz over the fall through exit */
+                emit_byte(jit, 0x85);
+                emit_byte(jit, 0xDB);
+                emit_byte(jit, (ins->opcode == OPCODE_BZ) ? 0x75 : 0x74);
+                emit_byte(jit, JIT_EXIT_SIZE);
+                emit_chained_exit(jit, n + 1, pc + 4);
+                emit_chained_exit(jit, n + 1, pc + ins->imm);
+                break;
+            }
+
+            case OPCODE_NOP:
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    ins = &jit->code_memory[start + len - 1];
+    if (ins->opcode != OPCODE_BZ && ins->opcode != OPCODE_BNZ)
+    {
+        emit_chained_exit(jit, len, get_pc_from_code_memory_index(start + len));
+    }
+
+    /* Chain exits of earlier blocks which were waiting for this one */
+    jit->block[start] = entry;
+    jit->blocks_translated++;
+    for (i = 0; i < jit->num_exits;)
+    {
+        if (jit->exits[i].target_index == start)
+        {
+            patch_rel32(jit, jit->exits[i].patch_offset, entry);
+            jit->blocks_chained++;
+            jit->exits[i] = jit->exits[--jit->num_exits];
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return entry;
+}
+
+/* Returns host code for the block at pc, translating it on first use */
+static unsigned char *
+jit_lookup(APEX_JIT *jit, int pc)
+{
+    int index = jit_index_from_pc(jit, pc);
+
+    if (index < 0 || jit->no_block[index])
+    {
+        return NULL;
+    }
+
+    if (jit->block[index])
+    {
+        return jit->block[index];
+    }
+    return jit_translate(jit, index);
+}
+
+#endif /* __x86_64__ */
+
+/*
+ * Creates a JIT for the given code memory. Returns NULL if the host is not
+ * x86-64 or executable memory can not be allocated, in which case the
+ * caller should use the interpreter.
+ */
+APEX_JIT *
+APEX_jit_create(const APEX_Instruction *code_memory, int size)
+{
+#if defined(__x86_64__)
+    APEX_JIT *jit;
+    void *code;
+
+    code = mmap(NULL, JIT_CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    jit = calloc(1, sizeof(APEX_JIT));
+    if (!jit)
+    {
+        munmap(code, JIT_CODE_CACHE_SIZE);
+        return NULL;
+    }
+
+    jit->code = code;
+    jit->code_memory = code_memory;
+    jit->code_memory_size = size;
+    jit->block = calloc(size, sizeof(unsigned char *));
+    jit->no_block = calloc(size, 1);
+    if (!jit->block || !jit->no_block)
+    {
+        APEX_jit_destroy(jit);
+        return NULL;
+    }
+
+    emit_trampolines(jit);
+    jit->enter = (void (*)(APEX_JIT_State *, void *))(void *)jit->code;
+    return jit;
+#else
+    (void)code_memory;
+    (void)size;
+    return NULL;
+#endif
+}
+
+void
+APEX_jit_destroy(APEX_JIT *jit)
+{
+    if (!jit)
+    {
+        return;
+    }
+
+#if defined(__x86_64__)
+    munmap(jit->code, JIT_CODE_CACHE_SIZE);
+#endif
+    free(jit->block);
+    free(jit->no_block);
+    free(jit->exits);
+    free(jit);
+}
+
+/*
+ * Runs the program through translated code until HALT, an error, or until
+ * max_insns instructions have been executed (negative means no limit).
+ * Instructions which can not be translated are executed by APEX_func_step.
+ */
+int
+APEX_jit_run(APEX_JIT *jit, APEX_CPU *cpu, int max_insns)
+{
+    APEX_JIT_State *state = &jit->state;
+    int status = APEX_FUNC_OK;
+    int start = cpu->insn_completed;
+    long long before;
+#if defined(__x86_64__)
+    unsigned char *block;
+#endif
+
+    memcpy(state->regs, cpu->regs, sizeof(state->regs));
+    state->zero_flag = cpu->zero_flag;
+    state->pc = cpu->pc;
+    state->data_memory = cpu->data_memory;
+    state->insn_count = 0;
+    state->insn_limit = (max_insns < 0) ? LLONG_MAX : max_insns;
+
+    while (state->insn_count < state->insn_limit)
+    {
+        before = state->insn_count;
+
+#if defined(__x86_64__)
+        block = jit_lookup(jit, state->pc);
+        if (block)
+        {
+            jit->block_entries++;
+            jit->enter(state, block);
+
+            /* The block did not run because of the instruction limit or
+             * because its first memory access was out of bounds */
+            if (state->insn_count != before)
+            {
+                continue;
+            }
+        }
+#endif
+
+        /* Fall back to the interpreter for a single instruction */
+        jit->fallbacks++;
+        memcpy(cpu->regs, state->regs, sizeof(state->regs));
+        cpu->zero_flag = state->zero_flag;
+        cpu->pc = state->pc;
+        cpu->insn_completed = start + (int)state->insn_count;
+
+        status = APEX_func_step(cpu);
+
+        memcpy(state->regs, cpu->regs, sizeof(state->regs));
+        state->zero_flag = cpu->zero_flag;
+        state->pc = cpu->pc;
+        state->insn_count = cpu->insn_completed - start;
+
+        if (status != APEX_FUNC_OK)
+        {
+            break;
+        }
+    }
+
+    memcpy(cpu->regs, state->regs, sizeof(state->regs));
+    cpu->zero_flag = state->zero_flag;
+    cpu->pc = state->pc;
+    cpu->insn_completed = start + (int)state->insn_count;
+    return status;
+}
+
+static int
+jit_compare(const APEX_CPU *cpu, const APEX_CPU *shadow)
+{
+    int i, same = TRUE;
+
+    if (cpu->pc != shadow->pc || cpu->zero_flag != shadow->zero_flag
+        || cpu->insn_completed != shadow->insn_completed)
+    {
+        fprintf(stderr, "APEX_JIT:   pc %d/%d zero_flag %d/%d instructions %d/%d\n",
+                cpu->pc, shadow->pc, cpu->zero_flag, shadow->zero_flag,
+                cpu->insn_completed, shadow->insn_completed);
+        same = FALSE;
+    }
+
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (cpu->regs[i] != shadow->regs[i])
+        {
+            fprintf(stderr, "APEX_JIT:   R%d %d/%d\n", i, cpu->regs[i],
+                    shadow->regs[i]);
+            same = FALSE;
+        }
+    }
+
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (cpu->data_memory[i] != shadow->data_memory[i])
+        {
+            fprintf(stderr, "APEX_JIT:   MEM[%d] %d/%d\n", i,
+                    cpu->data_memory[i], shadow->data_memory[i]);
+            same = FALSE;
+        }
+    }
+    return same;
+}
+
+/*
+ * Runs the program through the JIT and, in lock-step, through the
+ * interpreter on a shadow copy of the cpu. The states are compared after
+ * every group of at most JIT_MAX_BLOCK_INSNS instructions.
+ */
+int
+APEX_jit_verify(APEX_JIT *jit, APEX_CPU *cpu)
+{
+    APEX_CPU *shadow;
+    int status, shadow_status, before, pc;
+
+    shadow = malloc(sizeof(APEX_CPU));
+    if (!shadow)
+    {
+        return APEX_FUNC_ERROR;
+    }
+    memcpy(shadow, cpu, sizeof(APEX_CPU));
+
+    do
+    {
+        before = cpu->insn_completed;
+        pc = cpu->pc;
+        status = APEX_jit_run(jit, cpu, JIT_MAX_BLOCK_INSNS);
+        shadow_status = APEX_func_run(shadow, cpu->insn_completed - before);
+        if (status == APEX_FUNC_ERROR && shadow_status == APEX_FUNC_OK)
+        {
+            shadow_status = APEX_func_step(shadow);
+        }
+
+        if (status != shadow_status || !jit_compare(cpu, shadow))
+        {
+            fprintf(stderr, "APEX_JIT: Lock-step mismatch in instructions %d-%d "
+                    "starting at pc(%d), JIT/interpreter shown above\n",
+                    before + 1, cpu->insn_completed, pc);
+            free(shadow);
+            return APEX_FUNC_ERROR;
+        }
+    } while (status == APEX_FUNC_OK);
+
+    fprintf(stderr, "APEX_JIT: Lock-step verification matched the interpreter for %d instructions\n",
+            cpu->insn_completed);
+    free(shadow);
+    return status;
+}
+
+void
+APEX_jit_print_stats(const APEX_JIT *jit)
+{
+    printf("APEX_JIT: blocks = %lld chained exits = %lld block entries = %lld "
+           "interpreter fallbacks = %lld flushes = %lld\n",
+           jit->blocks_translated, jit->blocks_chained, jit->block_entries,
+           jit->fallbacks, jit->flushes);
+}
@@ -0,0 +1,72 @@
+/*
+ * apex_jit.h
+ * Contains declarations of the x86-64 basic block JIT for the functional
+ * model of the APEX cpu
+ */
+#ifndef _APEX_JIT_H_
+#define _APEX_JIT_H_
+
+#include <stddef.h>
+
+#include "apex_cpu.h"
+
+/* Maximum number of APEX instructions translated into one host block */
+#define JIT_MAX_BLOCK_INSNS 64
+
+/* Size of the host code cache in bytes */
+#define JIT_CODE_CACHE_SIZE (1024 * 1024)
+
+/* Architectural state seen by translated code. Register R0-R7 and the zero
+ * flag live in host registers while inside translated code and are written
+ * back here on every exit to the dispatcher */
+typedef struct APEX_JIT_State
+{
+    int regs[REG_FILE_SIZE];
+    int zero_flag;
+    int pc;                        /* Next pc to execute on exit */
+    long long insn_count;          /* Instructions retired by translated code */
+    long long insn_limit;          /* Blocks are not entered past this count */
+    int *data_memory;
+} APEX_JIT_State;
+
+/* Block exit whose jump still points at the exit stub. It is patched to
+ * jump straight to the target block once that block is translated */
+typedef struct APEX_JIT_Exit
+{
+    size_t patch_offset;           /* Offset of the rel32 of the jmp */
+    int target_index;              /* Code memory index of the target */
+} APEX_JIT_Exit;
+
+typedef struct APEX_JIT
+{
+    const APEX_Instruction *code_memory;
+    int code_memory_size;
+
+    unsigned char *code;           /* Host code cache */
+    size_t code_used;
+    size_t code_reset;             /* Size of the trampolines at the start */
+    unsigned char *exit_stub;
+    void (*enter)(APEX_JIT_State *state, void *block);
+
+    unsigned char **block;         /* Host code for each code memory index */
+    unsigned char *no_block;       /* Index starts with an unsupported insn */
+    APEX_JIT_Exit *exits;
+    int num_exits;
+    int max_exits;
+
+    APEX_JIT_State state;
+
+    /* Statistics */
+    long long blocks_translated;
+    long long blocks_chained;
+    long long block_entries;
+    long long fallbacks;
+    long long flushes;
+} APEX_JIT;
+
+APEX_JIT *APEX_jit_create(const APEX_Instruction *code_memory, int size);
+void APEX_jit_destroy(APEX_JIT *jit);
+int APEX_jit_run(APEX_JIT *jit, APEX_CPU *cpu, int max_insns);
+int APEX_jit_verify(APEX_JIT *jit, APEX_CPU *cpu);
+void APEX_jit_print_stats(const APEX_JIT *jit);
+#endif
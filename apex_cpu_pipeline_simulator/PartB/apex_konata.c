@@ -0,0 +1,180 @@
+/*
+ * apex_konata.c
+ * Contains the pipeline trace export in the Kanata log format read by the
+ * Konata pipeline viewer. Every dynamic instruction is logged under the
+ * sequence number fetch gives it, and the stages log when it enters them.
+ * Decode stalls are shown on a second lane, and instructions squashed by a
+ * taken branch are retired as flushed.
+ * Instructions retire the cycle after writeback, so that it shows.
+ *
+ * Events are written as they happen, so the trace is streamed to the file
+ * and nothing is kept per instruction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Lanes of an instruction in the viewer */
+#define KONATA_LANE_STAGE 0
+#define KONATA_LANE_STALL 1
+
+/* Kinds of R (retire) records */
+#define KONATA_RETIRED 0
+#define KONATA_FLUSHED 1
+
+/* Pipeline trace being written */
+typedef struct APEX_Konata
+{
+    FILE *fp;
+    int clock;                     /* Cycle of the last record */
+    long long first_seq;           /* Instructions fetched before are not traced */
+    long long retired;
+    long long retiring;            /* Written back last cycle, 0 for none */
+} APEX_Konata;
+
+/* Moves the trace forward to cycle clock */
+static void
+konata_advance(APEX_Konata *konata, int clock)
+{
+    fprintf(konata->fp, "C\t%d\n", clock - konata->clock);
+    konata->clock = clock;
+
+    if (konata->retiring)
+    {
+        fprintf(konata->fp, "R\t%lld\t%lld\t%d\n", konata->retiring,
+                konata->retired++, KONATA_RETIRED);
+        konata->retiring = 0;
+    }
+}
+
+/* Returns the trace file, moved forward to the current cycle of cpu */
+static FILE *
+konata_at(APEX_CPU *cpu)
+{
+    APEX_Konata *konata = cpu->konata;
+
+    if (cpu->clock != konata->clock)
+    {
+        konata_advance(konata, cpu->clock);
+    }
+    return konata->fp;
+}
+
+/*
+ * Starts writing the pipeline trace of cpu to filename, from the next cycle
+ * on. Returns 0 on success.
+ */
+int
+APEX_konata_open(APEX_CPU *cpu, const char *filename)
+{
+    APEX_Konata *konata = calloc(1, sizeof(APEX_Konata));
+
+    if (!konata)
+    {
+        return -1;
+    }
+
+    konata->fp = fopen(filename, "w");
+    if (!konata->fp)
+    {
+        free(konata);
+        return -1;
+    }
+
+    fprintf(konata->fp, "Kanata\t0004\nC=\t%d\n", cpu->clock);
+    konata->clock = cpu->clock;
+    konata->first_seq = cpu->insn_fetched + 1;
+    cpu->konata = konata;
+    return 0;
+}
+
+/* Finishes the pipeline trace, returns 0 on success */
+int
+APEX_konata_close(APEX_CPU *cpu)
+{
+    APEX_Konata *konata = cpu->konata;
+    int ret;
+
+    if (!konata)
+    {
+        return 0;
+    }
+
+    if (konata->retiring)
+    {
+        konata_advance(konata, konata->clock + 1);
+    }
+    ret = fclose(konata->fp) == 0 ? 0 : -1;
+    free(konata);
+    cpu->konata = NULL;
+    return ret;
+}
+
+/* Returns TRUE if the instruction in stage is in the trace */
+static int
+konata_traced(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    return stage->seq >= cpu->konata->first_seq;
+}
+
+/* Logs the instruction fetch has just numbered */
+void
+APEX_konata_fetch(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    char text[64];
+    FILE *fp;
+
+    format_instruction(&cpu->code_memory[(stage->pc - 4000) / 4], text,
+                       sizeof(text));
+
+    fp = konata_at(cpu);
+    fprintf(fp, "I\t%lld\t%lld\t0\n", stage->seq, stage->seq);
+    fprintf(fp, "L\t%lld\t0\t%d: %s\n", stage->seq, stage->pc, text);
+    fprintf(fp, "S\t%lld\t%d\tF\n", stage->seq, KONATA_LANE_STAGE);
+}
+
+/* Logs the instruction in stage entering the stage called name */
+void
+APEX_konata_stage(APEX_CPU *cpu, const CPU_Stage *stage, const char *name)
+{
+    if (konata_traced(cpu, stage))
+    {
+        fprintf(konata_at(cpu), "S\t%lld\t%d\t%s\n", stage->seq,
+                KONATA_LANE_STAGE, name);
+    }
+}
+
+/* Logs a decode stall of the instruction in stage starting or ending */
+void
+APEX_konata_stall(APEX_CPU *cpu, const CPU_Stage *stage, int start)
+{
+    if (konata_traced(cpu, stage))
+    {
+        fprintf(konata_at(cpu), "%s\t%lld\t%d\tStl\n", start ? "S" : "E",
+                stage->seq, KONATA_LANE_STALL);
+    }
+}
+
+/* Logs the instruction in stage being written back, it retires next cycle */
+void
+APEX_konata_writeback(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    if (konata_traced(cpu, stage))
+    {
+        APEX_konata_stage(cpu, stage, "W");
+        cpu->konata->retiring = stage->seq;
+    }
+}
+
+/* Logs the instruction in stage being squashed by a taken branch */
+void
+APEX_konata_flush(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    if (konata_traced(cpu, stage))
+    {
+        fprintf(konata_at(cpu), "R\t%lld\t0\t%d\n", stage->seq,
+                KONATA_FLUSHED);
+    }
+}
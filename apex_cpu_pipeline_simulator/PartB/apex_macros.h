@@ -38,7 +38,69 @@
 #define OPCODE_STR 0x10
 #define OPCODE_CMP 0x11
 #define OPCODE_NOP 0x12
+#define NUM_OPCODES 0x13
 
+/* Pipeline stages, used to index per stage counters */
+#define STAGE_FETCH 0x0
+#define STAGE_DECODE 0x1
+#define STAGE_EXECUTE 0x2
+#define STAGE_MEMORY 0x3
+#define STAGE_WRITEBACK 0x4
+#define NUM_STAGES 0x5
+
+/* Cycles counted individually by the latency histograms, longer ones go in
+ * the last bucket */
+#define LATENCY_BUCKETS 32
+
+/* CPI stack categories, every cycle is charged to one of them */
+#define CPI_BASE 0x0               /* An instruction retired */
+#define CPI_DATA_STALL 0x1         /* RAW stall on a forwarded result */
+#define CPI_LOAD_USE 0x2           /* RAW stall on a load in execute */
+#define CPI_CONTROL 0x3            /* Branch flush and redirect bubbles */
+#define CPI_STRUCTURAL 0x4         /* Execute busy with an older instruction */
+#define CPI_DRAIN 0x5              /* Pipeline depth, filled at start and drained by HALT */
+#define NUM_CPI 0x6
+
+/* Where decode got an operand from, counted by the hazard coverage */
+#define COVERAGE_REGFILE 0x0       /* Register file */
+#define COVERAGE_EXECUTE 0x1       /* Forwarded from the instruction that left execute */
+#define COVERAGE_MEMORY 0x2        /* Forwarded from the instruction that left memory */
+#define COVERAGE_STALL 0x3         /* Not available, load-use stall */
+#define NUM_COVERAGE_SOURCES 0x4
+
+/* Register operands of an instruction: rs1, rs2 and rs3 */
+#define NUM_OPERAND_SLOTS 0x3
+
+/* Events of the energy model, see apex_stats.c */
+#define ENERGY_REGFILE_READ 0x0    /* Operand read from the register file */
+#define ENERGY_REGFILE_WRITE 0x1
+#define ENERGY_LATCH_WRITE 0x2     /* Instruction passed to the next latch */
+#define ENERGY_ALU_OP 0x3
+#define ENERGY_MUL_OP 0x4
+#define ENERGY_DIV_OP 0x5
+#define ENERGY_MEMORY_ACCESS 0x6   /* Data memory read or write */
+#define ENERGY_FLUSH 0x7           /* Taken branch redirecting fetch */
+#define ENERGY_LEAKAGE 0x8         /* Static energy, per cycle */
+#define NUM_ENERGY_EVENTS 0x9
+
+/* Clock of the energy model unless the cost table sets it */
+#define ENERGY_DEFAULT_MHZ 500.0
+
+/* Simulated cycles per span of the Chrome trace, see apex_chrome.c */
+#define CHROME_CHUNK_CYCLES 100000
+
+/* Simulated cycles between snapshots of the metrics endpoint, see apex_metrics.c */
+#define METRICS_PUBLISH_CYCLES 65536
+
+/* Status codes returned by the functional model */
+#define APEX_FUNC_OK 0x0
+#define APEX_FUNC_HALT 0x1
+#define APEX_FUNC_ERROR 0x2
+
+/* Status codes returned by APEX_cpu_cycle */
+#define APEX_CYCLE_OK 0x0
+#define APEX_CYCLE_HALT 0x1
+#define APEX_CYCLE_ERROR 0x2
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
@@ -46,4 +108,14 @@
 /* Set this flag to 1 to enable cycle single-step mode */
 #define ENABLE_SINGLE_STEP 1
 
+/* Set this flag to 1 to time the stage functions and output on the host,
+ * or build with make EXTRA_CFLAGS=-DENABLE_HOST_PROFILE=1 */
+#ifndef ENABLE_HOST_PROFILE
+#define ENABLE_HOST_PROFILE 0
+#endif
+
+/* Host profile slots, the stages use their STAGE_* index */
+#define HOST_OUTPUT 0x5
+#define NUM_HOST_SLOTS 0x6
+
 #endif
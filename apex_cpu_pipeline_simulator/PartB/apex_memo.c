@@ -0,0 +1,534 @@
+/*
+ * apex_memo.c
+ * Contains timing memoization for the pipeline. The pipeline is simulated
+ * timing only (no values) and is driven by branch outcomes produced by the
+ * functional model. Timing only, the pipeline is a deterministic function of
+ * its latch and scoreboard state and of the outcomes it consumes, so the
+ * cycles spent between two visits to loop headers can be cached by that state
+ * and replayed whenever the same state and outcomes come around again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cfg.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define MEMO_KEY_WORDS 12
+#define MEMO_HASH_BITS 16
+#define MEMO_MAX_SEGMENT_CYCLES 4096
+
+/* Timing state of the pipeline at the start of a cycle */
+typedef struct APEX_Memo_Snapshot
+{
+    CPU_Stage fetch;
+    CPU_Stage decode;
+    CPU_Stage execute;
+    CPU_Stage memory;
+    CPU_Stage writeback;
+    int pc;
+    int fetch_from_next_cycle;
+    int valid_regs[REG_FILE_SIZE];
+} APEX_Memo_Snapshot;
+
+/* Result of simulating from a state until the next loop header */
+typedef struct APEX_Memo_Entry
+{
+    int key[MEMO_KEY_WORDS];
+    int num_outcomes;              /* Branch outcomes consumed, in order */
+    unsigned char *outcomes;
+    int cycles;
+    int insns;
+    int records;                   /* Instructions executed */
+    int status;                    /* APEX_CYCLE_OK or APEX_CYCLE_HALT */
+    APEX_Memo_Snapshot exit;
+    struct APEX_Memo_Entry *next;
+} APEX_Memo_Entry;
+
+typedef struct APEX_Memo
+{
+    APEX_CPU *func;                /* Functional model producing outcomes */
+    int func_status;
+
+    /* Outcomes consumed by the current segment are outcomes[keep..head),
+     * outcomes not consumed yet are outcomes[head..count) */
+    unsigned char *outcomes;
+    int keep;
+    int head;
+    int count;
+    int capacity;
+
+    /* Instructions the timing only cpu has executed, segments replayed
+     * included */
+    long long executed;
+
+    APEX_Memo_Entry *table[1 << MEMO_HASH_BITS];
+    int num_entries;
+
+    /* Stats */
+    long long segments;
+    long long hits;
+    long long replayed_cycles;
+} APEX_Memo;
+
+static int
+get_code_memory_index_from_pc(const int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+/* Segments start when fetch reaches the head of a loop, where the pipeline
+ * state is most likely to repeat */
+static int
+memo_is_boundary(const APEX_CPU *cpu, int pc)
+{
+    int index = get_code_memory_index_from_pc(pc);
+    const APEX_Block *block;
+
+    if (pc < 4000 || (pc - 4000) % 4 != 0 || index >= cpu->code_memory_size)
+    {
+        return FALSE;
+    }
+    block = &cpu->cfg->blocks[cpu->cfg->block_of[index]];
+    return block->start == index && block->loop_header;
+}
+
+/*
+ * Runs the functional model until n outcomes are buffered or it stops.
+ * Returns TRUE if n outcomes are available.
+ */
+static int
+memo_produce(APEX_Memo *memo, int n)
+{
+    const APEX_Instruction *last;
+    APEX_CPU *func = memo->func;
+    int index, end, taken;
+
+    while (memo->count - memo->head < n && memo->func_status == APEX_FUNC_OK)
+    {
+        if (func->pc < 4000 || (func->pc - 4000) % 4 != 0
+            || get_code_memory_index_from_pc(func->pc) >= func->code_memory_size)
+        {
+            /* Let the functional model report the bad pc */
+            memo->func_status = APEX_func_step(func);
+            continue;
+        }
+
+        /* Branches only end blocks, run everything before the last one */
+        index = get_code_memory_index_from_pc(func->pc);
+        end = func->cfg->blocks[func->cfg->block_of[index]].end;
+        if (end > index)
+        {
+            memo->func_status = APEX_func_run_block(func, end - index);
+            if (memo->func_status != APEX_FUNC_OK)
+            {
+                continue;
+            }
+        }
+
+        /* BZ and BNZ do not change the zero flag, so the outcome is known
+         * before the branch is executed */
+        last = &func->code_memory[end];
+        taken = -1;
+        if (last->opcode == OPCODE_BZ)
+        {
+            taken = (func->zero_flag == TRUE);
+        }
+        else if (last->opcode == OPCODE_BNZ)
+        {
+            taken = (func->zero_flag == FALSE);
+        }
+
+        memo->func_status = APEX_func_step(func);
+        if (memo->func_status == APEX_FUNC_ERROR || taken < 0)
+        {
+            continue;
+        }
+
+        if (memo->count == memo->capacity)
+        {
+            /* Drop outcomes of earlier segments before growing the buffer */
+            memmove(memo->outcomes, memo->outcomes + memo->keep,
+                    memo->count - memo->keep);
+            memo->count -= memo->keep;
+            memo->head -= memo->keep;
+            memo->keep = 0;
+            if (memo->count > memo->capacity / 2)
+            {
+                memo->capacity *= 2;
+                memo->outcomes = realloc(memo->outcomes, memo->capacity);
+            }
+        }
+        memo->outcomes[memo->count++] = (unsigned char)taken;
+    }
+    return memo->count - memo->head >= n;
+}
+
+/*
+ * Runs the functional model until it has executed n instructions or stopped.
+ * Returns FALSE if it faulted before that.
+ */
+static int
+memo_run_ahead(APEX_Memo *memo, long long n)
+{
+    while (memo->func->insn_completed < n && memo->func_status == APEX_FUNC_OK)
+    {
+        memo_produce(memo, memo->count - memo->head + 1);
+    }
+    return memo->func->insn_completed >= n
+           || memo->func_status != APEX_FUNC_ERROR;
+}
+
+/*
+ * Record source of the timing only cpu, which only knows branch outcomes.
+ * Instructions reach execute in program order, so the timing cpu stops at
+ * the instruction the functional model faulted on.
+ */
+static int
+memo_next_record(void *source, const CPU_Stage *stage, int *memory_address)
+{
+    APEX_Memo *memo = source;
+
+    *memory_address = -1;
+    if (!memo_run_ahead(memo, memo->executed + 1))
+    {
+        return -1;
+    }
+    memo->executed++;
+
+    if (stage->opcode != OPCODE_BZ && stage->opcode != OPCODE_BNZ)
+    {
+        return 0;
+    }
+
+    if (!memo_produce(memo, 1))
+    {
+        return -1;
+    }
+    return memo->outcomes[memo->head++];
+}
+
+static void
+memo_make_key(const APEX_CPU *cpu, int *key)
+{
+    const CPU_Stage *stages[4];
+    int i, mask = 0;
+
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        mask |= (cpu->valid_regs[i] != 0) << i;
+    }
+
+    stages[0] = &cpu->decode;
+    stages[1] = &cpu->execute;
+    stages[2] = &cpu->memory;
+    stages[3] = &cpu->writeback;
+
+    /* The fetch latch is only scratch space, all that matters is whether
+     * fetch is enabled and where it fetches next */
+    key[0] = cpu->pc;
+    key[1] = cpu->fetch_from_next_cycle;
+    key[2] = mask;
+    key[3] = cpu->fetch.has_insn;
+    for (i = 0; i < 4; ++i)
+    {
+        key[4 + 2 * i] = stages[i]->has_insn | (stages[i]->stalled << 1);
+        key[5 + 2 * i] = stages[i]->has_insn ? stages[i]->pc : 0;
+    }
+}
+
+/* FNV-1a */
+static unsigned int
+memo_hash(const int *key)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < MEMO_KEY_WORDS * sizeof(int); ++i)
+    {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return (h ^ (h >> MEMO_HASH_BITS)) & ((1 << MEMO_HASH_BITS) - 1);
+}
+
+static void
+memo_save(const APEX_CPU *cpu, APEX_Memo_Snapshot *snap)
+{
+    snap->fetch = cpu->fetch;
+    snap->decode = cpu->decode;
+    snap->execute = cpu->execute;
+    snap->memory = cpu->memory;
+    snap->writeback = cpu->writeback;
+    snap->pc = cpu->pc;
+    snap->fetch_from_next_cycle = cpu->fetch_from_next_cycle;
+    memcpy(snap->valid_regs, cpu->valid_regs, sizeof(snap->valid_regs));
+}
+
+static void
+memo_restore(APEX_CPU *cpu, const APEX_Memo_Snapshot *snap)
+{
+    cpu->fetch = snap->fetch;
+    cpu->decode = snap->decode;
+    cpu->execute = snap->execute;
+    cpu->memory = snap->memory;
+    cpu->writeback = snap->writeback;
+    cpu->pc = snap->pc;
+    cpu->fetch_from_next_cycle = snap->fetch_from_next_cycle;
+    memcpy(cpu->valid_regs, snap->valid_regs, sizeof(snap->valid_regs));
+}
+
+/* Returns the entry for key whose outcomes match the upcoming ones, and
+ * which does not run past a fault of the functional model */
+static APEX_Memo_Entry *
+memo_lookup(APEX_Memo *memo, const int *key, unsigned int hash)
+{
+    APEX_Memo_Entry *entry;
+
+    for (entry = memo->table[hash]; entry; entry = entry->next)
+    {
+        if (memcmp(entry->key, key, sizeof(entry->key)) != 0
+            || !memo_run_ahead(memo, memo->executed + entry->records))
+        {
+            continue;
+        }
+
+        if (entry->num_outcomes == 0)
+        {
+            return entry;
+        }
+
+        if (memo_produce(memo, entry->num_outcomes)
+            && memcmp(entry->outcomes, memo->outcomes + memo->head,
+                      entry->num_outcomes) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Simulates cycles in detail until fetch reaches the next loop header and
+ * records the result under key. Returns the status of the last cycle.
+ */
+static int
+memo_simulate_segment(APEX_Memo *memo, APEX_CPU *cpu, const int *key,
+                      unsigned int hash)
+{
+    APEX_Memo_Entry *entry;
+    int start_clock = cpu->clock;
+    int start_insns = cpu->insn_completed;
+    long long start_executed = memo->executed;
+    int prev_pc = cpu->pc;
+    int status;
+
+    while (TRUE)
+    {
+        status = APEX_cpu_cycle(cpu);
+        if (status != APEX_CYCLE_OK)
+        {
+            break;
+        }
+
+        if ((cpu->pc != prev_pc && memo_is_boundary(cpu, cpu->pc))
+            || cpu->clock - start_clock >= MEMO_MAX_SEGMENT_CYCLES)
+        {
+            break;
+        }
+        prev_pc = cpu->pc;
+    }
+
+    if (status == APEX_CYCLE_ERROR)
+    {
+        return status;
+    }
+
+    entry = calloc(1, sizeof(APEX_Memo_Entry));
+    memcpy(entry->key, key, sizeof(entry->key));
+    entry->num_outcomes = memo->head - memo->keep;
+    entry->outcomes = malloc(entry->num_outcomes + 1);
+    memcpy(entry->outcomes, memo->outcomes + memo->keep, entry->num_outcomes);
+    entry->cycles = cpu->clock - start_clock;
+    entry->insns = cpu->insn_completed - start_insns;
+    entry->records = memo->executed - start_executed;
+    entry->status = status;
+    memo_save(cpu, &entry->exit);
+
+    entry->next = memo->table[hash];
+    memo->table[hash] = entry;
+    memo->num_entries++;
+    return status;
+}
+
+static void
+memo_free(APEX_Memo *memo)
+{
+    APEX_Memo_Entry *entry, *next;
+    int i;
+
+    for (i = 0; i < (1 << MEMO_HASH_BITS); ++i)
+    {
+        for (entry = memo->table[i]; entry; entry = next)
+        {
+            next = entry->next;
+            free(entry->outcomes);
+            free(entry);
+        }
+    }
+    free(memo->outcomes);
+    free(memo->func);
+    free(memo);
+}
+
+/*
+ * Runs cpu to completion with timing memoization. On return cpu holds the
+ * pipeline timing (clock, insn_completed, latches) and func the architectural
+ * state computed by the functional model. Returns the final cycle status.
+ */
+static int
+memo_run(APEX_Memo *memo, APEX_CPU *cpu)
+{
+    APEX_Memo_Entry *entry;
+    int key[MEMO_KEY_WORDS];
+    unsigned int hash;
+    int status = APEX_CYCLE_OK;
+
+    cpu->timing_only = TRUE;
+    cpu->debug_messages = FALSE;
+    cpu->next_record = memo_next_record;
+    cpu->record_source = memo;
+
+    while (status == APEX_CYCLE_OK)
+    {
+        memo->segments++;
+        memo->keep = memo->head;
+        memo_make_key(cpu, key);
+        hash = memo_hash(key);
+
+        entry = memo_lookup(memo, key, hash);
+        if (entry)
+        {
+            memo_restore(cpu, &entry->exit);
+            cpu->clock += entry->cycles;
+            cpu->insn_completed += entry->insns;
+            memo->head += entry->num_outcomes;
+            memo->executed += entry->records;
+            memo->hits++;
+            memo->replayed_cycles += entry->cycles;
+            status = entry->status;
+        }
+        else
+        {
+            status = memo_simulate_segment(memo, cpu, key, hash);
+        }
+    }
+
+    /* The timing model may retire HALT before the functional model needs
+     * to run that far */
+    if (memo->func_status == APEX_FUNC_OK)
+    {
+        memo->func_status = APEX_func_run(memo->func, -1);
+    }
+    return status;
+}
+
+/* Runs a copy of cpu through the full pipeline, values included */
+static APEX_CPU *
+memo_run_full(const APEX_CPU *cpu, int *status)
+{
+    APEX_CPU *full = malloc(sizeof(APEX_CPU));
+
+    *full = *cpu;
+    full->debug_messages = FALSE;
+    do
+    {
+        *status = APEX_cpu_cycle(full);
+    } while (*status == APEX_CYCLE_OK);
+    return full;
+}
+
+/*
+ * Simulates the whole program on the pipeline with timing memoization and
+ * prints the final state. With check, the program is also simulated in full
+ * detail and cycles, instructions and architectural state are compared.
+ * Returns 0 on success and 1 on an error or a checker mismatch.
+ */
+int
+APEX_cpu_memo(APEX_CPU *cpu, int check)
+{
+    APEX_Memo *memo;
+    APEX_CPU *initial, *full;
+    int status, full_status, ret = 0;
+
+    memo = calloc(1, sizeof(APEX_Memo));
+    initial = malloc(sizeof(APEX_CPU));
+    if (!memo || !initial)
+    {
+        free(memo);
+        free(initial);
+        return 1;
+    }
+    *initial = *cpu;
+
+    memo->func = malloc(sizeof(APEX_CPU));
+    *memo->func = *cpu;
+    memo->func_status = APEX_FUNC_OK;
+    memo->capacity = 4096;
+    memo->outcomes = malloc(memo->capacity);
+
+    status = memo_run(memo, cpu);
+    if (status == APEX_CYCLE_HALT && memo->func_status == APEX_FUNC_HALT)
+    {
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+    }
+    else
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+        ret = 1;
+    }
+    printf("APEX_MEMO: segments = %lld hits = %lld entries = %d replayed cycles = %lld (%.1f%%)\n",
+           memo->segments, memo->hits, memo->num_entries, memo->replayed_cycles,
+           cpu->clock ? 100.0 * memo->replayed_cycles / cpu->clock : 0.0);
+
+    /* Architectural state comes from the functional model */
+    memcpy(cpu->regs, memo->func->regs, sizeof(cpu->regs));
+    memcpy(cpu->data_memory, memo->func->data_memory, sizeof(cpu->data_memory));
+    cpu->zero_flag = memo->func->zero_flag;
+
+    if (check && ret != 0)
+    {
+        printf("APEX_MEMO: Checker skipped, the program did not complete\n");
+    }
+    else if (check)
+    {
+        full = memo_run_full(initial, &full_status);
+        if (full_status != status || full->clock != cpu->clock
+            || full->insn_completed != cpu->insn_completed
+            || memcmp(full->regs, cpu->regs, sizeof(cpu->regs)) != 0
+            || memcmp(full->valid_regs, cpu->valid_regs, sizeof(cpu->valid_regs)) != 0
+            || memcmp(full->data_memory, cpu->data_memory, sizeof(cpu->data_memory)) != 0)
+        {
+            printf("APEX_MEMO: Checker mismatch, memoized cycles = %d instructions = %d, full simulation cycles = %d instructions = %d\n",
+                   cpu->clock, cpu->insn_completed, full->clock,
+                   full->insn_completed);
+            ret = 1;
+        }
+        else
+        {
+            printf("APEX_MEMO: Checker matched full simulation, cycles = %d instructions = %d\n",
+                   full->clock, full->insn_completed);
+        }
+        free(full);
+    }
+
+    print_register_state(cpu);
+    print_data_memory(cpu);
+
+    free(initial);
+    memo_free(memo);
+    return ret;
+}
@@ -0,0 +1,340 @@
+/*
+ * apex_metrics.c
+ * Contains the live metrics endpoint of long runs. A server thread answers
+ * HTTP requests on a local port with the progress of the simulation in the
+ * Prometheus text format: cycles, retired instructions, IPC, stalls, the
+ * CPI stack and host MIPS.
+ *
+ * The pipeline publishes a snapshot every METRICS_PUBLISH_CYCLES cycles
+ * without taking a lock: the snapshot is written between two increments of
+ * a sequence number, and the server copies it again if the number was odd
+ * or changed while it read, so the simulation never waits on a scrape.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static const char *const metrics_stage_names[NUM_STAGES] = {
+    "fetch", "decode", "execute", "memory", "writeback"
+};
+
+static const char *const metrics_cpi_names[NUM_CPI] = {
+    "base", "data_stall", "load_use", "control", "structural", "drain"
+};
+
+/* Values of a snapshot, published as a whole */
+typedef struct APEX_Metrics_Values
+{
+    long long cycles;
+    long long instructions;
+    long long stalled[NUM_STAGES];
+    long long cpi_stack[NUM_CPI];
+    long long branch_flushes;
+    long long squashed;
+    long long host_ns;             /* Host time since the endpoint started */
+    double ipc;                    /* Since the previous snapshot */
+    double mips;
+    int running;
+} APEX_Metrics_Values;
+
+/*
+ * Latest snapshot. The words are relaxed atomics so that the copies of the
+ * two threads may overlap, and the sequence number orders them.
+ */
+static struct
+{
+    atomic_uint seq;               /* Odd while the snapshot is written */
+    _Atomic long long words[sizeof(APEX_Metrics_Values) / sizeof(long long) + 1];
+} metrics_snapshot;
+
+static int metrics_socket = -1;
+static long long metrics_start_ns;
+static APEX_Metrics_Values metrics_last; /* Of the simulation thread */
+
+/* Returns the host monotonic time in ns */
+static long long
+metrics_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Copies values into the snapshot, from the simulation thread only */
+static void
+metrics_store(const APEX_Metrics_Values *values)
+{
+    long long words[sizeof(metrics_snapshot.words) / sizeof(long long)] = {0};
+    unsigned int seq = atomic_load_explicit(&metrics_snapshot.seq,
+                                            memory_order_relaxed);
+    size_t i;
+
+    memcpy(words, values, sizeof(*values));
+    atomic_store_explicit(&metrics_snapshot.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+    {
+        atomic_store_explicit(&metrics_snapshot.words[i], words[i],
+                              memory_order_relaxed);
+    }
+    atomic_store_explicit(&metrics_snapshot.seq, seq + 2, memory_order_release);
+}
+
+/* Copies the snapshot into values, retrying while it is being written */
+static void
+metrics_load(APEX_Metrics_Values *values)
+{
+    long long words[sizeof(metrics_snapshot.words) / sizeof(long long)];
+    unsigned int seq;
+    size_t i;
+
+    do
+    {
+        seq = atomic_load_explicit(&metrics_snapshot.seq, memory_order_acquire);
+        for (i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+        {
+            words[i] = atomic_load_explicit(&metrics_snapshot.words[i],
+                                            memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1)
+             || seq != atomic_load_explicit(&metrics_snapshot.seq,
+                                            memory_order_relaxed));
+    memcpy(values, words, sizeof(*values));
+}
+
+/* Appends a metric of one sample without labels to buffer */
+static int
+metrics_print(char *buffer, int size, const char *name, const char *type,
+              const char *help, double value)
+{
+    return snprintf(buffer, size, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n",
+                    name, help, name, type, name, value);
+}
+
+/* Writes the metrics of the snapshot to buffer, returns their length */
+static int
+metrics_format(char *buffer, int size)
+{
+    APEX_Metrics_Values values;
+    int length = 0;
+    int i;
+
+    metrics_load(&values);
+
+    length += metrics_print(buffer + length, size - length,
+                            "apex_cycles_total", "counter",
+                            "Simulated clock cycles.", values.cycles);
+    length += metrics_print(buffer + length, size - length,
+                            "apex_instructions_retired_total", "counter",
+                            "Instructions written back.", values.instructions);
+    length += metrics_print(buffer + length, size - length, "apex_ipc",
+                            "gauge", "Instructions per cycle over the last "
+                            "published cycles.", values.ipc);
+    length += metrics_print(buffer + length, size - length,
+                            "apex_ipc_average", "gauge",
+                            "Instructions per cycle since the start.",
+                            values.cycles
+                            ? (double)values.instructions / values.cycles : 0.0);
+    length += metrics_print(buffer + length, size - length, "apex_host_mips",
+                            "gauge", "Simulated instructions per host "
+                            "microsecond over the last published cycles.",
+                            values.mips);
+    length += metrics_print(buffer + length, size - length,
+                            "apex_host_seconds", "counter",
+                            "Host time since the endpoint started, at the "
+                            "last snapshot.", values.host_ns / 1e9);
+    length += metrics_print(buffer + length, size - length,
+                            "apex_branch_flushes_total", "counter",
+                            "Taken branches redirecting fetch.",
+                            values.branch_flushes);
+    length += metrics_print(buffer + length, size - length,
+                            "apex_squashed_instructions_total", "counter",
+                            "Instructions flushed by taken branches.",
+                            values.squashed);
+    length += metrics_print(buffer + length, size - length, "apex_running",
+                            "gauge", "1 while the simulation runs.",
+                            values.running);
+
+    length += snprintf(buffer + length, size - length,
+                       "# HELP apex_stage_stalled_cycles_total Cycles a stage "
+                       "held an instruction.\n"
+                       "# TYPE apex_stage_stalled_cycles_total counter\n");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        length += snprintf(buffer + length, size - length,
+                           "apex_stage_stalled_cycles_total{stage=\"%s\"} %lld\n",
+                           metrics_stage_names[i], values.stalled[i]);
+    }
+
+    length += snprintf(buffer + length, size - length,
+                       "# HELP apex_cpi_stack_cycles_total Cycles by CPI stack "
+                       "category.\n"
+                       "# TYPE apex_cpi_stack_cycles_total counter\n");
+    for (i = 0; i < NUM_CPI; ++i)
+    {
+        length += snprintf(buffer + length, size - length,
+                           "apex_cpi_stack_cycles_total{category=\"%s\"} %lld\n",
+                           metrics_cpi_names[i], values.cpi_stack[i]);
+    }
+    return length;
+}
+
+/* Answers one HTTP request on connection */
+static void
+metrics_answer(int connection)
+{
+    char request[1024];
+    char body[8192];
+    char header[256];
+    ssize_t received;
+    int length;
+
+    received = recv(connection, request, sizeof(request) - 1, 0);
+    if (received <= 0)
+    {
+        return;
+    }
+    request[received] = '\0';
+
+    if (strncmp(request, "GET /metrics ", 13) != 0
+        && strncmp(request, "GET / ", 6) != 0)
+    {
+        length = snprintf(header, sizeof(header),
+                          "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n"
+                          "Connection: close\r\n\r\n");
+        send(connection, header, length, MSG_NOSIGNAL);
+        return;
+    }
+
+    length = metrics_format(body, sizeof(body));
+    if (length >= (int)sizeof(body))
+    {
+        length = sizeof(body) - 1;
+    }
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %d\r\nConnection: close\r\n\r\n", length);
+    send(connection, header, strlen(header), MSG_NOSIGNAL);
+    send(connection, body, length, MSG_NOSIGNAL);
+}
+
+/* Server thread, answers requests until the process exits */
+static void *
+metrics_serve(void *arg)
+{
+    int connection;
+
+    (void)arg;
+    APEX_chrome_thread_name("metrics");
+    for (;;)
+    {
+        connection = accept(metrics_socket, NULL, NULL);
+        if (connection < 0)
+        {
+            continue;
+        }
+        metrics_answer(connection);
+        close(connection);
+    }
+    return NULL;
+}
+
+/*
+ * Starts serving the metrics of cpu on port of the loopback interface, any
+ * free port if port is 0, and has the pipeline publish them. Returns the
+ * port, -1 if the endpoint can not be started.
+ */
+int
+APEX_metrics_start(APEX_CPU *cpu, int port)
+{
+    struct sockaddr_in address;
+    socklen_t address_size = sizeof(address);
+    pthread_t thread;
+    int on = 1;
+
+    if (metrics_socket < 0)
+    {
+        metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (metrics_socket < 0)
+        {
+            return -1;
+        }
+        setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (bind(metrics_socket, (struct sockaddr *)&address,
+                 sizeof(address)) < 0
+            || listen(metrics_socket, 16) < 0
+            || getsockname(metrics_socket, (struct sockaddr *)&address,
+                           &address_size) < 0)
+        {
+            close(metrics_socket);
+            metrics_socket = -1;
+            return -1;
+        }
+
+        metrics_start_ns = metrics_now();
+        if (pthread_create(&thread, NULL, metrics_serve, NULL) != 0)
+        {
+            close(metrics_socket);
+            metrics_socket = -1;
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    else
+    {
+        getsockname(metrics_socket, (struct sockaddr *)&address,
+                    &address_size);
+    }
+
+    APEX_metrics_publish(cpu, TRUE);
+    return ntohs(address.sin_port);
+}
+
+/*
+ * Publishes the counters of cpu, running FALSE once the run is over. Called
+ * by the pipeline once cpu->clock reaches cpu->next_metrics.
+ */
+void
+APEX_metrics_publish(APEX_CPU *cpu, int running)
+{
+    APEX_Metrics_Values values;
+    long long cycles, instructions, ns;
+
+    memset(&values, 0, sizeof(values));
+    values.cycles = cpu->clock;
+    values.instructions = cpu->insn_completed;
+    memcpy(values.stalled, cpu->stats.stalled, sizeof(values.stalled));
+    memcpy(values.cpi_stack, cpu->stats.cpi_stack, sizeof(values.cpi_stack));
+    values.branch_flushes = cpu->stats.branch_flushes;
+    values.squashed = cpu->stats.squashed;
+    values.host_ns = metrics_now() - metrics_start_ns;
+    values.running = running;
+
+    /* Rates over the cycles since the last snapshot */
+    cycles = values.cycles - metrics_last.cycles;
+    instructions = values.instructions - metrics_last.instructions;
+    ns = values.host_ns - metrics_last.host_ns;
+    values.ipc = cycles > 0 ? (double)instructions / cycles : metrics_last.ipc;
+    values.mips = ns > 0 && cycles > 0 ? instructions * 1e3 / ns
+                                       : metrics_last.mips;
+
+    metrics_store(&values);
+    metrics_last = values;
+    cpu->next_metrics = running ? cpu->clock + METRICS_PUBLISH_CYCLES : 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * apex_mrc.c
+ * Contains the miss ratio curves of the data memory accesses. The memory
+ * stage reports every access, and the LRU stack distance of its line, the
+ * number of distinct lines touched since the last access to it, is counted
+ * for a few line sizes at once. A fully associative LRU cache of C lines
+ * misses exactly the accesses with a distance of C or more, plus the first
+ * access to every line, so one run gives the miss ratio of every size.
+ *
+ * Distances are found in O(log n) with a Fenwick tree over access times
+ * holding a 1 at the last access of every line: the distance is the number
+ * of ones after the previous access of the line. When the times run out the
+ * live ones are renumbered in order, so the tree stays a fixed size.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Line sizes of 1, 2, 4, 8 and 16 words */
+#define MRC_NUM_LINE_SIZES 5
+
+/* Access times in the tree before they are renumbered */
+#define MRC_TIME_SLOTS 65536
+
+/* Stack distances of one line size */
+typedef struct APEX_Mrc_Stack
+{
+    int line_words;
+    int num_lines;
+    int *last;                     /* Time of the last access by line, 0 for never */
+    int *tree;                     /* Fenwick tree by time, 1 based */
+    int time;                      /* Time of the last access */
+    long long *distances;          /* Accesses by stack distance */
+    long long cold;                /* First accesses to a line */
+} APEX_Mrc_Stack;
+
+/* Miss ratio curves being collected */
+typedef struct APEX_Mrc
+{
+    long long accesses;
+    APEX_Mrc_Stack stacks[MRC_NUM_LINE_SIZES];
+} APEX_Mrc;
+
+/* Line and time of a live line being renumbered */
+typedef struct APEX_Mrc_Live
+{
+    int line;
+    int time;
+} APEX_Mrc_Live;
+
+/* Adds delta at time in the tree */
+static void
+mrc_tree_add(int *tree, int time, int delta)
+{
+    for (; time <= MRC_TIME_SLOTS; time += time & -time)
+    {
+        tree[time] += delta;
+    }
+}
+
+/* Returns the sum of the tree up to and including time */
+static int
+mrc_tree_sum(const int *tree, int time)
+{
+    int sum = 0;
+
+    for (; time > 0; time -= time & -time)
+    {
+        sum += tree[time];
+    }
+    return sum;
+}
+
+/* Orders live lines by time */
+static int
+mrc_compare(const void *a, const void *b)
+{
+    return ((const APEX_Mrc_Live *)a)->time - ((const APEX_Mrc_Live *)b)->time;
+}
+
+/* Renumbers the last accesses of stack 1, 2, ... keeping their order */
+static void
+mrc_renumber(APEX_Mrc_Stack *stack)
+{
+    APEX_Mrc_Live live[DATA_MEMORY_SIZE];
+    int num_live = 0;
+    int i;
+
+    for (i = 0; i < stack->num_lines; ++i)
+    {
+        if (stack->last[i])
+        {
+            live[num_live].line = i;
+            live[num_live].time = stack->last[i];
+            num_live++;
+        }
+    }
+    qsort(live, num_live, sizeof(APEX_Mrc_Live), mrc_compare);
+
+    memset(stack->tree, 0, (MRC_TIME_SLOTS + 1) * sizeof(int));
+    for (i = 0; i < num_live; ++i)
+    {
+        stack->last[live[i].line] = i + 1;
+        mrc_tree_add(stack->tree, i + 1, 1);
+    }
+    stack->time = num_live;
+}
+
+/* Counts an access to line in stack */
+static void
+mrc_stack_access(APEX_Mrc_Stack *stack, int line)
+{
+    int last = stack->last[line];
+
+    if (stack->time == MRC_TIME_SLOTS)
+    {
+        mrc_renumber(stack);
+        last = stack->last[line];
+    }
+
+    if (last)
+    {
+        stack->distances[mrc_tree_sum(stack->tree, stack->time)
+                         - mrc_tree_sum(stack->tree, last)]++;
+        mrc_tree_add(stack->tree, last, -1);
+    }
+    else
+    {
+        stack->cold++;
+    }
+
+    stack->time++;
+    stack->last[line] = stack->time;
+    mrc_tree_add(stack->tree, stack->time, 1);
+}
+
+/* Frees the miss ratio curves of cpu */
+void
+APEX_mrc_free(APEX_CPU *cpu)
+{
+    APEX_Mrc_Stack *stack;
+    int i;
+
+    if (!cpu->mrc)
+    {
+        return;
+    }
+
+    for (i = 0; i < MRC_NUM_LINE_SIZES; ++i)
+    {
+        stack = &cpu->mrc->stacks[i];
+        free(stack->last);
+        free(stack->tree);
+        free(stack->distances);
+    }
+    free(cpu->mrc);
+    cpu->mrc = NULL;
+}
+
+/* Starts collecting miss ratio curves, returns -1 if they can't be allocated */
+int
+APEX_mrc_enable(APEX_CPU *cpu)
+{
+    APEX_Mrc_Stack *stack;
+    int i;
+
+    if (cpu->mrc)
+    {
+        return 0;
+    }
+
+    cpu->mrc = calloc(1, sizeof(APEX_Mrc));
+    if (!cpu->mrc)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < MRC_NUM_LINE_SIZES; ++i)
+    {
+        stack = &cpu->mrc->stacks[i];
+        stack->line_words = 1 << i;
+        stack->num_lines = DATA_MEMORY_SIZE / stack->line_words;
+        stack->last = calloc(stack->num_lines, sizeof(int));
+        stack->tree = calloc(MRC_TIME_SLOTS + 1, sizeof(int));
+        stack->distances = calloc(stack->num_lines, sizeof(long long));
+        if (!stack->last || !stack->tree || !stack->distances)
+        {
+            APEX_mrc_free(cpu);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Counts an access of the memory stage to data memory address */
+void
+APEX_mrc_access(APEX_CPU *cpu, int address)
+{
+    int i;
+
+    cpu->mrc->accesses++;
+    for (i = 0; i < MRC_NUM_LINE_SIZES; ++i)
+    {
+        mrc_stack_access(&cpu->mrc->stacks[i], address >> i);
+    }
+}
+
+/*
+ * Writes the miss ratio curves of cpu to filename as CSV: a row for every
+ * power of two cache size in words, up to the whole data memory, with the
+ * miss ratio of a fully associative LRU cache of that size for every line
+ * size. Line sizes larger than the cache are left empty. Returns 0 on
+ * success.
+ */
+int
+APEX_mrc_write(const APEX_CPU *cpu, const char *filename)
+{
+    const APEX_Mrc *mrc = cpu->mrc;
+    const APEX_Mrc_Stack *stack;
+    long long hits[MRC_NUM_LINE_SIZES] = {0};
+    int lines[MRC_NUM_LINE_SIZES] = {0};
+    int words, i;
+    FILE *fp;
+
+    if (!mrc)
+    {
+        return -1;
+    }
+
+    fp = fopen(filename, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    fprintf(fp, "cache_words");
+    for (i = 0; i < MRC_NUM_LINE_SIZES; ++i)
+    {
+        fprintf(fp, ",line_%d", mrc->stacks[i].line_words);
+    }
+    fprintf(fp, "\n");
+
+    for (words = 1; words <= DATA_MEMORY_SIZE; words *= 2)
+    {
+        fprintf(fp, "%d", words);
+        for (i = 0; i < MRC_NUM_LINE_SIZES; ++i)
+        {
+            stack = &mrc->stacks[i];
+            if (words < stack->line_words)
+            {
+                fprintf(fp, ",");
+                continue;
+            }
+
+            /* Hits are the accesses with a distance under the lines held */
+            for (; lines[i] < words / stack->line_words; ++lines[i])
+            {
+                hits[i] += stack->distances[lines[i]];
+            }
+            fprintf(fp, ",%.6f", mrc->accesses
+                    ? 1.0 - (double)hits[i] / mrc->accesses : 0.0);
+        }
+        fprintf(fp, "\n");
+    }
+
+    if (fclose(fp) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * apex_profile.c
+ * Contains the per instruction profiler. The pipeline stages count, for
+ * every code memory index, how often the instruction retired, the cycles it
+ * stalled in decode, the flushes it caused and the operands forwarded to it.
+ * At the end of a run the program listing is printed annotated with these
+ * counts, most expensive instruction first, or written in the callgrind
+ * format for KCachegrind.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cfg.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Bubbles behind a taken branch: the squashed decode and the skipped fetch */
+#define PROFILE_FLUSH_PENALTY 2
+
+/* Listing entry being sorted */
+typedef struct APEX_Profile_Line
+{
+    int index;
+    long long cost;
+} APEX_Profile_Line;
+
+/* Returns the cycles charged to the instruction with counts profile */
+static long long
+profile_cost(const APEX_PC_Profile *profile)
+{
+    return profile->executed + profile->stall_cycles
+           + PROFILE_FLUSH_PENALTY * profile->flushes;
+}
+
+/* Orders by cost, most expensive first, then by address */
+static int
+profile_compare(const void *a, const void *b)
+{
+    const APEX_Profile_Line *x = a, *y = b;
+
+    if (x->cost != y->cost)
+    {
+        return x->cost < y->cost ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+/* Starts profiling cpu, returns -1 if the counters can not be allocated */
+int
+APEX_profile_enable(APEX_CPU *cpu)
+{
+    if (!cpu->profile)
+    {
+        cpu->profile = calloc(cpu->code_memory_size ? cpu->code_memory_size : 1,
+                              sizeof(APEX_PC_Profile));
+    }
+    return cpu->profile ? 0 : -1;
+}
+
+/* Prints the annotated listing of a profiled cpu */
+void
+APEX_profile_print(const APEX_CPU *cpu)
+{
+    APEX_Profile_Line *lines;
+    const APEX_PC_Profile *profile;
+    long long total = 0;
+    char text[64];
+    int i;
+
+    if (!cpu->profile)
+    {
+        return;
+    }
+
+    lines = malloc((cpu->code_memory_size ? cpu->code_memory_size : 1)
+                   * sizeof(APEX_Profile_Line));
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        lines[i].index = i;
+        lines[i].cost = profile_cost(&cpu->profile[i]);
+        total += lines[i].cost;
+    }
+    qsort(lines, cpu->code_memory_size, sizeof(APEX_Profile_Line),
+          profile_compare);
+
+    printf("APEX_PROFILE: %6s %7s %10s %10s %8s %8s %10s  %s\n", "pc", "share",
+           "cost", "executed", "stalls", "flushes", "forwards", "instruction");
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        profile = &cpu->profile[lines[i].index];
+        format_instruction(&cpu->code_memory[lines[i].index], text,
+                           sizeof(text));
+        printf("APEX_PROFILE: %6d %6.2f%% %10lld %10lld %8lld %8lld %10lld  %s\n",
+               4000 + 4 * lines[i].index,
+               total ? 100.0 * lines[i].cost / total : 0.0, lines[i].cost,
+               profile->executed, profile->stall_cycles, profile->flushes,
+               profile->forwards, text);
+    }
+    free(lines);
+}
+
+/*
+ * Writes the profile of cpu to filename in the callgrind format. Every basic
+ * block is a function named after its first pc, and every instruction a cost
+ * line at its address and at its line in source, the .asm file the code was
+ * read from, which holds one instruction per line. Returns 0 on success.
+ */
+int
+APEX_profile_write_callgrind(const APEX_CPU *cpu, const char *source,
+                             const char *filename)
+{
+    const APEX_PC_Profile *profile;
+    const APEX_Block *block;
+    long long totals[4] = {0};
+    FILE *fp;
+    int b, i;
+
+    if (!cpu->profile)
+    {
+        return -1;
+    }
+
+    fp = fopen(filename, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    fprintf(fp, "# callgrind format\nversion: 1\ncreator: apex_sim\ncmd: %s\n",
+            source);
+    fprintf(fp, "positions: instr line\nevents: Ir Cycles Stall Flush\n");
+    fprintf(fp, "event: Ir : Instructions retired\n");
+    fprintf(fp, "event: Cycles : Cycles charged to the instruction\n");
+    fprintf(fp, "event: Stall : Cycles stalled in decode\n");
+    fprintf(fp, "event: Flush : Bubble cycles of taken branch flushes\n");
+    fprintf(fp, "\nfl=%s\n", source);
+
+    for (b = 0; b < cpu->cfg->num_blocks; ++b)
+    {
+        block = &cpu->cfg->blocks[b];
+        fprintf(fp, "\nfn=B%d:%d\n", b, 4000 + 4 * block->start);
+        for (i = block->start; i <= block->end; ++i)
+        {
+            profile = &cpu->profile[i];
+            fprintf(fp, "0x%x %d %lld %lld %lld %lld\n", 4000 + 4 * i, i + 1,
+                    profile->executed, profile_cost(profile),
+                    profile->stall_cycles,
+                    PROFILE_FLUSH_PENALTY * profile->flushes);
+            totals[0] += profile->executed;
+            totals[1] += profile_cost(profile);
+            totals[2] += profile->stall_cycles;
+            totals[3] += PROFILE_FLUSH_PENALTY * profile->flushes;
+        }
+    }
+    fprintf(fp, "\ntotals: %lld %lld %lld %lld\n", totals[0], totals[1],
+            totals[2], totals[3]);
+
+    if (fclose(fp) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,917 @@
+/*
+ * apex_sample.c
+ * Contains sampled pipeline simulation. The functional model fast-forwards
+ * through the program and only chosen intervals are simulated on the
+ * pipeline, each one starting from the architectural state the functional
+ * model reached, after a short warm-up to fill the pipeline.
+ *
+ * SimPoint: a profiling pass records a basic block vector (instructions
+ * executed per basic block) for every interval. The vectors are randomly
+ * projected to a few dimensions and clustered with k-means, k chosen by the
+ * Bayesian information criterion. The intervals closest to each centroid are
+ * simulated and weighted by the size of their cluster.
+ *
+ * SMARTS: a short window is measured every period instructions over the
+ * whole run, each after its own warm-up. The windows are a systematic sample
+ * of the program, so their mean CPI comes with a confidence interval.
+ *
+ * Sampled intervals only depend on the state the functional model hands
+ * over, so both collect that state first and simulate the intervals on a
+ * pool of worker threads.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cfg.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define SAMPLE_PROJECTED_DIMS 15
+#define SAMPLE_KMEANS_RESTARTS 5
+#define SAMPLE_KMEANS_ITERATIONS 100
+#define SAMPLE_BIC_THRESHOLD 0.9
+#define SAMPLE_Z_95 1.96
+#define SAMPLE_Z_997 3.0
+#define SAMPLE_JOBS_PER_THREAD 64
+
+/* Deterministic random numbers, so sampled runs are reproducible */
+static unsigned int
+sample_random(unsigned long long *seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int)(*seed >> 33);
+}
+
+static double
+sample_random_unit(unsigned long long *seed)
+{
+    return sample_random(seed) / 2147483648.0;
+}
+
+/* Makes pipe an idle pipeline with the architectural state of arch */
+static void
+sample_pipeline_from(APEX_CPU *pipe, const APEX_CPU *arch)
+{
+    *pipe = *arch;
+    memset(pipe->valid_regs, 0, sizeof(pipe->valid_regs));
+    memset(&pipe->fetch, 0, sizeof(pipe->fetch));
+    memset(&pipe->decode, 0, sizeof(pipe->decode));
+    memset(&pipe->execute, 0, sizeof(pipe->execute));
+    memset(&pipe->memory, 0, sizeof(pipe->memory));
+    memset(&pipe->writeback, 0, sizeof(pipe->writeback));
+    pipe->clock = 0;
+    pipe->insn_completed = 0;
+    pipe->fetch_from_next_cycle = FALSE;
+    pipe->debug_messages = FALSE;
+    pipe->timing_only = FALSE;
+    pipe->checkpoint_at = 0;
+    pipe->checkpoint_file = NULL;
+    pipe->profile = NULL;          /* Shared by the worker threads otherwise */
+    pipe->latency = NULL;
+    pipe->coverage = NULL;
+    pipe->critical = NULL;
+    pipe->mrc = NULL;
+    pipe->bpred = NULL;
+    pipe->next_interval = 0;
+    pipe->next_metrics = 0;
+    pipe->intervals = NULL;
+    pipe->konata = NULL;
+    pipe->chrome_chunk_start = 0;  /* Jobs are traced as a whole */
+    pipe->fetch.has_insn = TRUE;
+}
+
+/*
+ * Simulates the pipeline from the architectural state of arch. After warmup
+ * instructions have retired, measures the cycles taken to retire the next
+ * length instructions. Returns the number of instructions measured, which
+ * is less than length if the program ends first.
+ */
+static int
+sample_detailed(const APEX_CPU *arch, int warmup, int length, int *cycles)
+{
+    APEX_CPU *pipe = malloc(sizeof(APEX_CPU));
+    int status = APEX_CYCLE_OK;
+    int start_clock, start_insns, insns;
+
+    sample_pipeline_from(pipe, arch);
+    while (status == APEX_CYCLE_OK && pipe->insn_completed < warmup)
+    {
+        status = APEX_cpu_cycle(pipe);
+    }
+
+    start_clock = pipe->clock;
+    start_insns = pipe->insn_completed;
+    while (status == APEX_CYCLE_OK && pipe->insn_completed < warmup + length)
+    {
+        status = APEX_cpu_cycle(pipe);
+    }
+
+    *cycles = pipe->clock - start_clock;
+    insns = pipe->insn_completed - start_insns;
+    free(pipe);
+    return insns;
+}
+
+/* A sampled interval to simulate in detail */
+typedef struct APEX_Sample_Job
+{
+    APEX_CPU *arch;                /* State at the start of the warm-up */
+    int warmup;
+    int length;
+    int cycles;                    /* Results */
+    int insns;
+} APEX_Sample_Job;
+
+typedef struct APEX_Sample_Pool
+{
+    APEX_Sample_Job *jobs;
+    int num_jobs;
+    int next;                      /* Next job to hand out */
+    pthread_mutex_t lock;
+} APEX_Sample_Pool;
+
+static void *
+sample_worker(void *arg)
+{
+    APEX_Sample_Pool *pool = arg;
+    APEX_Sample_Job *job;
+    long long start;
+    char args[64];
+    int i;
+
+    while (TRUE)
+    {
+        pthread_mutex_lock(&pool->lock);
+        i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->num_jobs)
+        {
+            break;
+        }
+
+        job = &pool->jobs[i];
+        start = APEX_chrome_begin();
+        job->insns = sample_detailed(job->arch, job->warmup, job->length,
+                                     &job->cycles);
+        snprintf(args, sizeof(args), "\"job\":%d,\"cycles\":%d", i,
+                 job->cycles);
+        APEX_chrome_end("sample_detailed", "simulate", start, args);
+    }
+    return NULL;
+}
+
+/* Worker thread started by sample_run_jobs */
+static void *
+sample_worker_thread(void *arg)
+{
+    APEX_chrome_thread_name("sampling worker");
+    return sample_worker(arg);
+}
+
+/*
+ * Simulates the jobs on up to threads worker threads and frees their states.
+ * Every job has its own cpu, so the workers share nothing but the job index.
+ */
+static void
+sample_run_jobs(APEX_Sample_Job *jobs, int num_jobs, int threads)
+{
+    APEX_Sample_Pool pool;
+    pthread_t *workers;
+    int i, started = 0;
+
+    pool.jobs = jobs;
+    pool.num_jobs = num_jobs;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    threads = threads < num_jobs ? threads : num_jobs;
+    workers = malloc((threads > 0 ? threads : 1) * sizeof(pthread_t));
+    for (i = 1; i < threads; ++i)
+    {
+        if (pthread_create(&workers[started], NULL, sample_worker_thread,
+                           &pool) == 0)
+        {
+            started++;
+        }
+    }
+
+    /* The calling thread works too, and alone if threads is 1 */
+    sample_worker(&pool);
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        free(jobs[i].arch);
+    }
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+/* Adds a job starting from a copy of the state of arch */
+static void
+sample_add_job(APEX_Sample_Job *job, const APEX_CPU *arch, int warmup,
+               int length)
+{
+    job->arch = malloc(sizeof(APEX_CPU));
+    *job->arch = *arch;
+    job->warmup = warmup;
+    job->length = length;
+    job->cycles = 0;
+    job->insns = 0;
+}
+
+/* Simulates a copy of cpu through the full pipeline, returns its CPI */
+static double
+sample_full_cpi(const APEX_CPU *cpu)
+{
+    int cycles, insns;
+
+    insns = sample_detailed(cpu, 0, 0x7fffffff, &cycles);
+    return insns ? (double)cycles / insns : 0.0;
+}
+
+/* Profile of a program, one projected basic block vector per interval */
+typedef struct APEX_Profile
+{
+    int num_intervals;
+    int capacity;
+    int *insns;                    /* Instructions in each interval */
+    double *vectors;               /* num_intervals x SAMPLE_PROJECTED_DIMS */
+    int total_insns;
+} APEX_Profile;
+
+/*
+ * Runs cpu through the functional model and records the basic block vector
+ * of every interval of interval instructions, the last one may be shorter.
+ * The vectors are written to bbv_file in SimPoint's frequency vector format
+ * if it is not NULL. Returns FALSE if the program does not complete.
+ */
+static int
+sample_profile(APEX_CPU *cpu, int interval, const char *bbv_file,
+               APEX_Profile *profile)
+{
+    const APEX_CFG *cfg = cpu->cfg;
+    unsigned long long seed = 1;
+    double *projection, *vector;
+    int *counts;
+    int status = APEX_FUNC_OK;
+    int interval_end, index, before, b, d, n;
+    FILE *fp = NULL;
+
+    /* The caller frees the profile even if it could not be made */
+    memset(profile, 0, sizeof(*profile));
+    if (bbv_file)
+    {
+        fp = fopen(bbv_file, "w");
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to write basic block vectors to %s\n",
+                    bbv_file);
+            return FALSE;
+        }
+    }
+
+    /* Each block gets a random direction in the projected space */
+    projection = malloc(cfg->num_blocks * SAMPLE_PROJECTED_DIMS * sizeof(double));
+    for (b = 0; b < cfg->num_blocks * SAMPLE_PROJECTED_DIMS; ++b)
+    {
+        projection[b] = sample_random_unit(&seed) * 2.0 - 1.0;
+    }
+    counts = calloc(cfg->num_blocks, sizeof(int));
+
+    interval_end = cpu->insn_completed + interval;
+    while (status == APEX_FUNC_OK)
+    {
+        index = (cpu->pc - 4000) / 4;
+        if (cpu->pc < 4000 || (cpu->pc - 4000) % 4 != 0
+            || index >= cpu->code_memory_size)
+        {
+            /* Let the functional model report the bad pc */
+            status = APEX_func_step(cpu);
+            break;
+        }
+
+        before = cpu->insn_completed;
+        status = APEX_func_run_block(cpu, interval_end - cpu->insn_completed);
+        counts[cfg->block_of[index]] += cpu->insn_completed - before;
+
+        if (cpu->insn_completed < interval_end && status == APEX_FUNC_OK)
+        {
+            continue;
+        }
+
+        /* Close the interval */
+        n = interval - (interval_end - cpu->insn_completed);
+        if (n == 0)
+        {
+            break;
+        }
+
+        if (profile->num_intervals == profile->capacity)
+        {
+            profile->capacity = profile->capacity ? 2 * profile->capacity : 64;
+            profile->insns = realloc(profile->insns,
+                                     profile->capacity * sizeof(int));
+            profile->vectors = realloc(profile->vectors,
+                                       profile->capacity * SAMPLE_PROJECTED_DIMS
+                                       * sizeof(double));
+        }
+        profile->insns[profile->num_intervals] = n;
+        vector = &profile->vectors[profile->num_intervals * SAMPLE_PROJECTED_DIMS];
+        memset(vector, 0, SAMPLE_PROJECTED_DIMS * sizeof(double));
+
+        if (fp)
+        {
+            fprintf(fp, "T");
+        }
+        for (b = 0; b < cfg->num_blocks; ++b)
+        {
+            if (counts[b] == 0)
+            {
+                continue;
+            }
+
+            for (d = 0; d < SAMPLE_PROJECTED_DIMS; ++d)
+            {
+                vector[d] += (double)counts[b] / n
+                             * projection[b * SAMPLE_PROJECTED_DIMS + d];
+            }
+            if (fp)
+            {
+                /* SimPoint numbers blocks from 1 */
+                fprintf(fp, ":%d:%d ", b + 1, counts[b]);
+            }
+            counts[b] = 0;
+        }
+        if (fp)
+        {
+            fprintf(fp, "\n");
+        }
+
+        profile->num_intervals++;
+        profile->total_insns += n;
+        interval_end = cpu->insn_completed + interval;
+    }
+
+    if (fp)
+    {
+        fclose(fp);
+    }
+    free(projection);
+    free(counts);
+    return status == APEX_FUNC_HALT;
+}
+
+static double
+sample_distance(const double *a, const double *b)
+{
+    double sum = 0.0, diff;
+    int d;
+
+    for (d = 0; d < SAMPLE_PROJECTED_DIMS; ++d)
+    {
+        diff = a[d] - b[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/*
+ * Clusters the intervals into k clusters with k-means, intervals weighted by
+ * their instruction count, from k-means++ seeds. Returns the weighted sum of
+ * squared distances to the centroids.
+ */
+static double
+sample_kmeans(const APEX_Profile *profile, int k, unsigned long long *seed,
+              int *assignment, double *centroids)
+{
+    const int n = profile->num_intervals;
+    double *nearest = malloc(n * sizeof(double));
+    double *weights = malloc(k * sizeof(double));
+    double total, pick, distance, distortion = 0.0;
+    int i, c, d, best, changed, iteration;
+
+    /* k-means++: each new seed is chosen with probability proportional to
+     * its squared distance from the seeds so far */
+    i = sample_random(seed) % n;
+    memcpy(centroids, &profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+           SAMPLE_PROJECTED_DIMS * sizeof(double));
+    for (i = 0; i < n; ++i)
+    {
+        nearest[i] = sample_distance(&profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+                                     centroids);
+    }
+    for (c = 1; c < k; ++c)
+    {
+        total = 0.0;
+        for (i = 0; i < n; ++i)
+        {
+            total += nearest[i] * profile->insns[i];
+        }
+
+        pick = sample_random_unit(seed) * total;
+        for (i = 0; i < n - 1; ++i)
+        {
+            pick -= nearest[i] * profile->insns[i];
+            if (pick < 0.0)
+            {
+                break;
+            }
+        }
+
+        memcpy(&centroids[c * SAMPLE_PROJECTED_DIMS],
+               &profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+               SAMPLE_PROJECTED_DIMS * sizeof(double));
+        for (i = 0; i < n; ++i)
+        {
+            distance = sample_distance(&profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+                                       &centroids[c * SAMPLE_PROJECTED_DIMS]);
+            if (distance < nearest[i])
+            {
+                nearest[i] = distance;
+            }
+        }
+    }
+
+    /* Lloyd iterations */
+    for (i = 0; i < n; ++i)
+    {
+        assignment[i] = -1;
+    }
+    for (iteration = 0; iteration < SAMPLE_KMEANS_ITERATIONS; ++iteration)
+    {
+        changed = FALSE;
+        distortion = 0.0;
+        for (i = 0; i < n; ++i)
+        {
+            best = 0;
+            nearest[i] = sample_distance(&profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+                                         centroids);
+            for (c = 1; c < k; ++c)
+            {
+                distance = sample_distance(&profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+                                           &centroids[c * SAMPLE_PROJECTED_DIMS]);
+                if (distance < nearest[i])
+                {
+                    nearest[i] = distance;
+                    best = c;
+                }
+            }
+            changed |= (assignment[i] != best);
+            assignment[i] = best;
+            distortion += nearest[i] * profile->insns[i];
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        memset(centroids, 0, k * SAMPLE_PROJECTED_DIMS * sizeof(double));
+        memset(weights, 0, k * sizeof(double));
+        for (i = 0; i < n; ++i)
+        {
+            c = assignment[i];
+            weights[c] += profile->insns[i];
+            for (d = 0; d < SAMPLE_PROJECTED_DIMS; ++d)
+            {
+                centroids[c * SAMPLE_PROJECTED_DIMS + d]
+                    += profile->vectors[i * SAMPLE_PROJECTED_DIMS + d]
+                       * profile->insns[i];
+            }
+        }
+        for (c = 0; c < k; ++c)
+        {
+            for (d = 0; d < SAMPLE_PROJECTED_DIMS && weights[c] > 0.0; ++d)
+            {
+                centroids[c * SAMPLE_PROJECTED_DIMS + d] /= weights[c];
+            }
+        }
+    }
+
+    free(nearest);
+    free(weights);
+    return distortion;
+}
+
+/*
+ * Bayesian information criterion of a clustering, treating the clusters as
+ * spherical Gaussians with a shared variance (as in SimPoint and X-means)
+ */
+static double
+sample_bic(const APEX_Profile *profile, const int *assignment, int k,
+           double distortion)
+{
+    const double r = profile->total_insns;
+    const double d = SAMPLE_PROJECTED_DIMS;
+    double *sizes = calloc(k, sizeof(double));
+    double variance, likelihood = 0.0;
+    int i, c;
+
+    for (i = 0; i < profile->num_intervals; ++i)
+    {
+        sizes[assignment[i]] += profile->insns[i];
+    }
+
+    variance = r > k ? distortion / (d * (r - k)) : 0.0;
+    if (variance < 1e-12)
+    {
+        variance = 1e-12;
+    }
+
+    for (c = 0; c < k; ++c)
+    {
+        if (sizes[c] > 0.0)
+        {
+            likelihood += sizes[c] * log(sizes[c] / r);
+        }
+    }
+    likelihood -= r * d / 2.0 * log(2.0 * M_PI * variance) + (r - k) * d / 2.0;
+
+    free(sizes);
+    return likelihood - k * (d + 1.0) / 2.0 * log(r);
+}
+
+/*
+ * Clusters the profile for every k up to max_k and keeps the smallest k
+ * whose BIC is within SAMPLE_BIC_THRESHOLD of the best one. Returns k.
+ */
+static int
+sample_choose_clusters(const APEX_Profile *profile, int max_k, int *assignment)
+{
+    const int n = profile->num_intervals;
+    unsigned long long seed = 1;
+    double *bic, *centroids, distortion, best_distortion, low, high;
+    int **assignments;
+    int *trial;
+    int k, r, chosen;
+
+    if (max_k > n)
+    {
+        max_k = n;
+    }
+
+    bic = malloc((max_k + 1) * sizeof(double));
+    assignments = malloc((max_k + 1) * sizeof(int *));
+    centroids = malloc(max_k * SAMPLE_PROJECTED_DIMS * sizeof(double));
+    trial = malloc(n * sizeof(int));
+
+    for (k = 1; k <= max_k; ++k)
+    {
+        assignments[k] = malloc(n * sizeof(int));
+        best_distortion = -1.0;
+        for (r = 0; r < SAMPLE_KMEANS_RESTARTS; ++r)
+        {
+            distortion = sample_kmeans(profile, k, &seed, trial, centroids);
+            if (best_distortion < 0.0 || distortion < best_distortion)
+            {
+                best_distortion = distortion;
+                memcpy(assignments[k], trial, n * sizeof(int));
+            }
+        }
+        bic[k] = sample_bic(profile, assignments[k], k, best_distortion);
+    }
+
+    low = high = bic[1];
+    for (k = 2; k <= max_k; ++k)
+    {
+        low = bic[k] < low ? bic[k] : low;
+        high = bic[k] > high ? bic[k] : high;
+    }
+
+    chosen = max_k;
+    for (k = 1; k <= max_k; ++k)
+    {
+        if (bic[k] - low >= SAMPLE_BIC_THRESHOLD * (high - low))
+        {
+            chosen = k;
+            break;
+        }
+    }
+    memcpy(assignment, assignments[chosen], n * sizeof(int));
+
+    for (k = 1; k <= max_k; ++k)
+    {
+        free(assignments[k]);
+    }
+    free(assignments);
+    free(bic);
+    free(centroids);
+    free(trial);
+    return chosen;
+}
+
+/* Simulated intervals of a cluster */
+typedef struct APEX_Cluster
+{
+    int num_intervals;
+    double weight;                 /* Fraction of all instructions */
+    int samples[2];                /* Intervals closest to the centroid */
+    int num_samples;
+    double cpi[2];
+} APEX_Cluster;
+
+/* Picks the (up to) two intervals of each cluster closest to its centroid */
+static void
+sample_pick_intervals(const APEX_Profile *profile, const int *assignment,
+                      int k, APEX_Cluster *clusters)
+{
+    double *centroids = calloc(k * SAMPLE_PROJECTED_DIMS, sizeof(double));
+    double *best = malloc(2 * k * sizeof(double));
+    double distance;
+    APEX_Cluster *cluster;
+    int i, c, d;
+
+    for (i = 0; i < profile->num_intervals; ++i)
+    {
+        c = assignment[i];
+        clusters[c].num_intervals++;
+        clusters[c].weight += profile->insns[i];
+        for (d = 0; d < SAMPLE_PROJECTED_DIMS; ++d)
+        {
+            centroids[c * SAMPLE_PROJECTED_DIMS + d]
+                += profile->vectors[i * SAMPLE_PROJECTED_DIMS + d]
+                   * profile->insns[i];
+        }
+    }
+    for (c = 0; c < k; ++c)
+    {
+        for (d = 0; d < SAMPLE_PROJECTED_DIMS; ++d)
+        {
+            centroids[c * SAMPLE_PROJECTED_DIMS + d] /= clusters[c].weight;
+        }
+        clusters[c].weight /= profile->total_insns;
+    }
+
+    for (i = 0; i < profile->num_intervals; ++i)
+    {
+        cluster = &clusters[assignment[i]];
+        distance = sample_distance(&profile->vectors[i * SAMPLE_PROJECTED_DIMS],
+                                   &centroids[assignment[i] * SAMPLE_PROJECTED_DIMS]);
+        if (cluster->num_samples < 2)
+        {
+            best[2 * assignment[i] + cluster->num_samples] = distance;
+            cluster->samples[cluster->num_samples++] = i;
+        }
+        else if (distance < best[2 * assignment[i] + 1])
+        {
+            best[2 * assignment[i] + 1] = distance;
+            cluster->samples[1] = i;
+        }
+
+        /* Keep the closest interval first */
+        if (cluster->num_samples == 2
+            && best[2 * assignment[i] + 1] < best[2 * assignment[i]])
+        {
+            distance = best[2 * assignment[i]];
+            best[2 * assignment[i]] = best[2 * assignment[i] + 1];
+            best[2 * assignment[i] + 1] = distance;
+            d = cluster->samples[0];
+            cluster->samples[0] = cluster->samples[1];
+            cluster->samples[1] = d;
+        }
+    }
+
+    free(centroids);
+    free(best);
+}
+
+/* Orders simulated intervals by their position in the program */
+static int
+sample_compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Estimates the CPI of the program by SimPoint style sampling: profiles basic
+ * block vectors per interval instructions, clusters them into at most max_k
+ * phases and simulates up to two intervals per phase on the pipeline after
+ * warmup instructions of warm-up, on up to threads threads. With check, the
+ * whole program is also simulated to report the error of the estimate.
+ * Returns 0 on success.
+ */
+int
+APEX_cpu_simpoint(APEX_CPU *cpu, int interval, int warmup, int max_k,
+                  const char *bbv_file, int check, int threads)
+{
+    APEX_Profile profile;
+    APEX_Cluster *clusters;
+    APEX_Sample_Job *jobs;
+    APEX_CPU *func;
+    int *assignment, *order;
+    int k, c, s, i, num_order = 0, start;
+    long long detailed = 0;
+    double cpi = 0.0, variance = 0.0, mean, full;
+
+    if (interval <= 0 || warmup < 0 || max_k <= 0)
+    {
+        fprintf(stderr, "APEX_Error: Invalid sampling parameters\n");
+        return 1;
+    }
+
+    func = malloc(sizeof(APEX_CPU));
+    *func = *cpu;
+    if (!sample_profile(func, interval, bbv_file, &profile)
+        || profile.num_intervals == 0)
+    {
+        printf("APEX_SIMPOINT: Functional profile stopped at pc = %d, instructions = %d\n",
+               func->pc, func->insn_completed);
+        free(profile.insns);
+        free(profile.vectors);
+        free(func);
+        return 1;
+    }
+
+    assignment = malloc(profile.num_intervals * sizeof(int));
+    k = sample_choose_clusters(&profile, max_k, assignment);
+    clusters = calloc(k, sizeof(APEX_Cluster));
+    sample_pick_intervals(&profile, assignment, k, clusters);
+
+    printf("APEX_SIMPOINT: instructions = %d intervals = %d of %d instructions, clusters = %d\n",
+           profile.total_insns, profile.num_intervals, interval, k);
+
+    /* Collect the state at each chosen interval in program order,
+     * fast-forwarding the functional model from one to the next */
+    order = malloc(2 * k * sizeof(int));
+    for (c = 0; c < k; ++c)
+    {
+        for (s = 0; s < clusters[c].num_samples; ++s)
+        {
+            order[num_order++] = clusters[c].samples[s];
+        }
+    }
+    qsort(order, num_order, sizeof(int), sample_compare_int);
+
+    jobs = malloc(num_order * sizeof(APEX_Sample_Job));
+    *func = *cpu;
+    for (i = 0; i < num_order; ++i)
+    {
+        start = order[i] * interval - warmup;
+        start = start < 0 ? 0 : start;
+        APEX_func_run(func, start - func->insn_completed);
+        sample_add_job(&jobs[i], func, order[i] * interval - start,
+                       profile.insns[order[i]]);
+    }
+
+    sample_run_jobs(jobs, num_order, threads);
+    for (i = 0; i < num_order; ++i)
+    {
+        detailed += jobs[i].warmup + jobs[i].insns;
+        c = assignment[order[i]];
+        s = (clusters[c].samples[0] == order[i]) ? 0 : 1;
+        clusters[c].cpi[s] = jobs[i].insns
+                             ? (double)jobs[i].cycles / jobs[i].insns : 0.0;
+    }
+
+    /* Each cluster is a stratum: its CPI is the mean of its samples, and two
+     * samples give an estimate of the variance within it */
+    for (c = 0; c < k; ++c)
+    {
+        mean = clusters[c].cpi[0];
+        if (clusters[c].num_samples == 2)
+        {
+            mean = (clusters[c].cpi[0] + clusters[c].cpi[1]) / 2.0;
+            if (clusters[c].num_intervals > 2)
+            {
+                variance += clusters[c].weight * clusters[c].weight
+                            * (clusters[c].cpi[0] - clusters[c].cpi[1])
+                            * (clusters[c].cpi[0] - clusters[c].cpi[1]) / 4.0;
+            }
+        }
+        cpi += clusters[c].weight * mean;
+
+        printf("APEX_SIMPOINT: cluster %d: intervals = %d weight = %.4f simpoints =",
+               c, clusters[c].num_intervals, clusters[c].weight);
+        for (s = 0; s < clusters[c].num_samples; ++s)
+        {
+            printf(" %d (cpi %.4f)", clusters[c].samples[s], clusters[c].cpi[s]);
+        }
+        printf("\n");
+    }
+
+    printf("APEX_SIMPOINT: CPI = %.4f +/- %.4f (95%%), estimated cycles = %.0f\n",
+           cpi, SAMPLE_Z_95 * sqrt(variance), cpi * profile.total_insns);
+    printf("APEX_SIMPOINT: detailed instructions = %lld of %d (%.1fx fewer)\n",
+           detailed, profile.total_insns,
+           detailed ? (double)profile.total_insns / detailed : 0.0);
+
+    if (check)
+    {
+        full = sample_full_cpi(cpu);
+        printf("APEX_SIMPOINT: full simulation CPI = %.4f, error = %.2f%%\n",
+               full, full ? 100.0 * fabs(cpi - full) / full : 0.0);
+    }
+
+    free(jobs);
+    free(order);
+    free(clusters);
+    free(assignment);
+    free(profile.insns);
+    free(profile.vectors);
+    free(func);
+    return 0;
+}
+
+/*
+ * Estimates the CPI of the program by SMARTS style systematic sampling: every
+ * period instructions the functional model hands its state to the pipeline,
+ * which warms up for warmup instructions and then measures window
+ * instructions, samples simulated on up to threads threads. Reports the mean
+ * CPI with confidence intervals and the number of samples needed for a
+ * relative error of target_error at 99.7% confidence. With check, the whole
+ * program is also simulated to report the error of the estimate. Returns 0
+ * on success.
+ */
+int
+APEX_cpu_smarts(APEX_CPU *cpu, int period, int warmup, int window,
+                double target_error, int check, int threads)
+{
+    APEX_Sample_Job *jobs;
+    APEX_CPU *func;
+    int status = APEX_FUNC_OK, num_jobs = 0, max_jobs, i, n = 0;
+    long long detailed = 0;
+    double cpi, sum = 0.0, sum_squares = 0.0, mean, variance, cv, full;
+
+    if (window <= 0 || warmup < 0 || period < warmup + window
+        || target_error <= 0.0)
+    {
+        fprintf(stderr, "APEX_Error: Invalid sampling parameters\n");
+        return 1;
+    }
+
+    /* Samples are simulated in batches to bound the saved states */
+    max_jobs = SAMPLE_JOBS_PER_THREAD * (threads > 1 ? threads : 1);
+    jobs = malloc(max_jobs * sizeof(APEX_Sample_Job));
+    func = malloc(sizeof(APEX_CPU));
+    *func = *cpu;
+    while (status == APEX_FUNC_OK || num_jobs > 0)
+    {
+        if (status == APEX_FUNC_OK)
+        {
+            /* Warm-up and measurement start the period */
+            sample_add_job(&jobs[num_jobs++], func, warmup, window);
+            status = APEX_func_run(func, period);
+        }
+
+        if (num_jobs == max_jobs || (status != APEX_FUNC_OK && num_jobs > 0))
+        {
+            sample_run_jobs(jobs, num_jobs, threads);
+            for (i = 0; i < num_jobs; ++i)
+            {
+                detailed += warmup + jobs[i].insns;
+                if (jobs[i].insns == window)
+                {
+                    cpi = (double)jobs[i].cycles / jobs[i].insns;
+                    sum += cpi;
+                    sum_squares += cpi * cpi;
+                    n++;
+                }
+            }
+            num_jobs = 0;
+        }
+    }
+    free(jobs);
+
+    if (status != APEX_FUNC_HALT || n == 0)
+    {
+        printf("APEX_SMARTS: %s at pc = %d, instructions = %d\n",
+               n ? "Functional fast-forward stopped" : "Program too short to sample",
+               func->pc, func->insn_completed);
+        free(func);
+        return 1;
+    }
+
+    mean = sum / n;
+    variance = n > 1 ? (sum_squares - n * mean * mean) / (n - 1) : 0.0;
+    variance = variance < 0.0 ? 0.0 : variance;
+    cv = mean ? sqrt(variance) / mean : 0.0;
+
+    printf("APEX_SMARTS: instructions = %d samples = %d period = %d warmup = %d window = %d\n",
+           func->insn_completed, n, period, warmup, window);
+    printf("APEX_SMARTS: CPI = %.4f +/- %.4f (95%%) +/- %.4f (99.7%%), estimated cycles = %.0f\n",
+           mean, SAMPLE_Z_95 * sqrt(variance / n),
+           SAMPLE_Z_997 * sqrt(variance / n), mean * func->insn_completed);
+    printf("APEX_SMARTS: coefficient of variation = %.4f, samples needed for +/- %.1f%% at 99.7%% = %.0f\n",
+           cv, 100.0 * target_error,
+           ceil(SAMPLE_Z_997 * SAMPLE_Z_997 * cv * cv / (target_error * target_error)));
+    printf("APEX_SMARTS: detailed instructions = %lld of %d (%.1fx fewer)\n",
+           detailed, func->insn_completed,
+           detailed ? (double)func->insn_completed / detailed : 0.0);
+
+    if (check)
+    {
+        full = sample_full_cpi(cpu);
+        printf("APEX_SMARTS: full simulation CPI = %.4f, error = %.2f%%\n",
+               full, full ? 100.0 * fabs(mean - full) / full : 0.0);
+    }
+
+    free(func);
+    return 0;
+}
@@ -0,0 +1,665 @@
+/*
+ * apex_stats.c
+ * Contains reporting of the performance counters the pipeline stages keep in
+ * cpu->stats, at the end of a run and as a time series of fixed length
+ * intervals, the latency histograms of retired instructions, the hazard
+ * coverage of decode and the energy model built on the counters
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static const char *const stage_names[NUM_STAGES] = {
+    "fetch", "decode", "execute", "memory", "writeback"
+};
+
+static const char *const opcode_names[NUM_OPCODES] = {
+    "ADD", "SUB", "MUL", "DIV", "AND", "OR", "EXOR", "MOVC", "LOAD", "STORE",
+    "BZ", "BNZ", "HALT", "ADDL", "SUBL", "LDR", "STR", "CMP", "NOP"
+};
+
+/* Register operands decode reads, by opcode */
+static const int opcode_operands[NUM_OPCODES] = {
+    2, 2, 2, 2, 2, 2, 2, 0, 1, 2, 0, 0, 0, 1, 1, 2, 3, 2, 0
+};
+
+/* Opcodes writing a register at writeback */
+static const int opcode_writes[NUM_OPCODES] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0
+};
+
+static const char *const coverage_names[NUM_COVERAGE_SOURCES] = {
+    "regfile", "from_execute", "from_memory", "stall"
+};
+
+static const char *const energy_names[NUM_ENERGY_EVENTS] = {
+    "regfile_read", "regfile_write", "latch_write", "alu_op", "mul_op",
+    "div_op", "memory_access", "flush", "leakage"
+};
+
+/* Default pJ per event, in the range of a 45nm process */
+static const double energy_default_costs[NUM_ENERGY_EVENTS] = {
+    1.0, 1.5, 0.5, 0.5, 3.1, 10.0, 10.0, 2.0, 5.0
+};
+
+static const char *const cpi_names[NUM_CPI] = {
+    "base", "data_stall", "load_use", "control", "structural", "drain"
+};
+
+/* Interval time series being written */
+typedef struct APEX_Interval_Log
+{
+    FILE *fp;
+    int cycles;                    /* Cycles per interval */
+    int start_clock;               /* State at the start of the interval */
+    int start_insns;
+    APEX_Stats start;
+} APEX_Interval_Log;
+
+/*
+ * Prints the CPI stack: the cycles charged to each category, divided by the
+ * instructions retired, so that the categories add up to the CPI.
+ */
+void
+APEX_stats_print_cpi_stack(const APEX_CPU *cpu)
+{
+    double insns = cpu->insn_completed ? cpu->insn_completed : 1;
+    int i;
+
+    printf("APEX_CPI: %-11s %10s %8s %7s\n", "category", "cycles", "cpi",
+           "share");
+    for (i = 0; i < NUM_CPI; ++i)
+    {
+        printf("APEX_CPI: %-11s %10lld %8.4f %6.2f%%\n", cpi_names[i],
+               cpu->stats.cpi_stack[i], cpu->stats.cpi_stack[i] / insns,
+               cpu->clock ? 100.0 * cpu->stats.cpi_stack[i] / cpu->clock : 0.0);
+    }
+    printf("APEX_CPI: %-11s %10d %8.4f\n", "total", cpu->clock,
+           cpu->clock / insns);
+}
+
+/* Writes the row of the interval that ends now and starts the next one */
+static void
+intervals_write_row(APEX_Interval_Log *log, const APEX_CPU *cpu)
+{
+    int cycles = cpu->clock - log->start_clock;
+    int insns = cpu->insn_completed - log->start_insns;
+    int i;
+
+    if (cycles <= 0)
+    {
+        return;
+    }
+
+    fprintf(log->fp, "%d,%d,%d,%.4f", log->start_clock, cycles, insns,
+            (double)insns / cycles);
+    for (i = 0; i < NUM_CPI; ++i)
+    {
+        fprintf(log->fp, ",%lld",
+                cpu->stats.cpi_stack[i] - log->start.cpi_stack[i]);
+    }
+    fprintf(log->fp, ",%lld,%lld\n",
+            cpu->stats.branch_flushes - log->start.branch_flushes,
+            cpu->stats.squashed - log->start.squashed);
+
+    log->start_clock = cpu->clock;
+    log->start_insns = cpu->insn_completed;
+    log->start = cpu->stats;
+}
+
+/*
+ * Starts writing a row to filename, as CSV, for every interval of cycles
+ * cpu simulates from now on. Returns 0 on success.
+ */
+int
+APEX_stats_intervals_open(APEX_CPU *cpu, const char *filename, int cycles)
+{
+    APEX_Interval_Log *log;
+    int i;
+
+    if (cycles <= 0)
+    {
+        return -1;
+    }
+
+    log = calloc(1, sizeof(APEX_Interval_Log));
+    if (!log)
+    {
+        return -1;
+    }
+
+    log->fp = fopen(filename, "w");
+    if (!log->fp)
+    {
+        free(log);
+        return -1;
+    }
+
+    fprintf(log->fp, "start_cycle,cycles,instructions,ipc");
+    for (i = 0; i < NUM_CPI; ++i)
+    {
+        fprintf(log->fp, ",%s", cpi_names[i]);
+    }
+    fprintf(log->fp, ",branch_flushes,squashed\n");
+
+    log->cycles = cycles;
+    log->start_clock = cpu->clock;
+    log->start_insns = cpu->insn_completed;
+    log->start = cpu->stats;
+    cpu->intervals = log;
+    cpu->next_interval = cpu->clock + cycles;
+    return 0;
+}
+
+/* Called by the pipeline once cpu->clock reaches cpu->next_interval */
+void
+APEX_stats_interval(APEX_CPU *cpu)
+{
+    intervals_write_row(cpu->intervals, cpu);
+    cpu->next_interval = cpu->clock + cpu->intervals->cycles;
+}
+
+/*
+ * Writes the last, possibly shorter, interval and closes the time series.
+ * Returns 0 on success.
+ */
+int
+APEX_stats_intervals_close(APEX_CPU *cpu)
+{
+    APEX_Interval_Log *log = cpu->intervals;
+    int ret;
+
+    if (!log)
+    {
+        return 0;
+    }
+
+    intervals_write_row(log, cpu);
+    ret = fclose(log->fp) == 0 ? 0 : -1;
+    free(log);
+    cpu->intervals = NULL;
+    cpu->next_interval = 0;
+    return ret;
+}
+
+/* Starts recording latency histograms, returns -1 if they can't be allocated */
+int
+APEX_stats_latency_enable(APEX_CPU *cpu)
+{
+    if (!cpu->latency)
+    {
+        cpu->latency = calloc(1, sizeof(APEX_Latency));
+    }
+    return cpu->latency ? 0 : -1;
+}
+
+/* Adds cycles to histogram, the last bucket holds all longer ones */
+static void
+latency_add(long long *histogram, int cycles)
+{
+    if (cycles < 0)
+    {
+        cycles = 0;
+    }
+    histogram[cycles < LATENCY_BUCKETS ? cycles : LATENCY_BUCKETS - 1]++;
+}
+
+/*
+ * Records the latencies of the instruction in stage, which is being written
+ * back this cycle. Instructions that were not numbered at fetch, i.e. were
+ * already in flight when a checkpoint was restored, are skipped.
+ */
+void
+APEX_stats_latency_record(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Latency *latency = cpu->latency;
+    int opcode = stage->opcode;
+    int residency[NUM_STAGES];
+    int i;
+
+    if (!stage->seq || opcode < 0 || opcode >= NUM_OPCODES)
+    {
+        return;
+    }
+
+    /* Each stage lasts until the instruction enters the next one */
+    for (i = 0; i < STAGE_WRITEBACK; ++i)
+    {
+        residency[i] = stage->enter[i + 1] - stage->enter[i];
+    }
+    residency[STAGE_WRITEBACK] = cpu->clock + 1 - stage->enter[STAGE_WRITEBACK];
+
+    latency->count[opcode]++;
+    latency_add(latency->lifetime[opcode],
+                cpu->clock + 1 - stage->enter[STAGE_FETCH]);
+    latency->lifetime_sum[opcode] += cpu->clock + 1 - stage->enter[STAGE_FETCH];
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        latency_add(latency->residency[opcode][i], residency[i]);
+        latency->residency_sum[opcode][i] += residency[i];
+    }
+}
+
+/* Returns the smallest bucket holding at least fraction of count samples */
+static int
+latency_percentile(const long long *histogram, long long count,
+                   double fraction)
+{
+    long long seen = 0;
+    int b;
+
+    for (b = 0; b < LATENCY_BUCKETS - 1; ++b)
+    {
+        seen += histogram[b];
+        if (seen >= fraction * count)
+        {
+            break;
+        }
+    }
+    return b;
+}
+
+/* Prints the non zero buckets of histogram after label */
+static void
+latency_print_histogram(const char *opcode, const char *label,
+                        const long long *histogram)
+{
+    int b;
+
+    printf("APEX_LATENCY: %-5s %-9s", opcode, label);
+    for (b = 0; b < LATENCY_BUCKETS; ++b)
+    {
+        if (histogram[b])
+        {
+            printf(" %s%d:%lld", b == LATENCY_BUCKETS - 1 ? ">=" : "", b,
+                   histogram[b]);
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * Prints, for every opcode retired, the fetch to retire latency (mean,
+ * median, 90th percentile and histogram) and the mean cycles spent in each
+ * stage. Histograms of stages whose residency varies are printed as well.
+ */
+void
+APEX_stats_latency_print(const APEX_CPU *cpu)
+{
+    const APEX_Latency *latency = cpu->latency;
+    long long count;
+    int opcode, i, b, buckets;
+
+    if (!latency)
+    {
+        return;
+    }
+
+    printf("APEX_LATENCY: %-5s %10s %7s %4s %4s |", "op", "count", "mean",
+           "p50", "p90");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        printf(" %9s", stage_names[i]);
+    }
+    printf("\n");
+
+    for (opcode = 0; opcode < NUM_OPCODES; ++opcode)
+    {
+        count = latency->count[opcode];
+        if (!count)
+        {
+            continue;
+        }
+
+        printf("APEX_LATENCY: %-5s %10lld %7.2f %4d %4d |", opcode_names[opcode],
+               count, (double)latency->lifetime_sum[opcode] / count,
+               latency_percentile(latency->lifetime[opcode], count, 0.5),
+               latency_percentile(latency->lifetime[opcode], count, 0.9));
+        for (i = 0; i < NUM_STAGES; ++i)
+        {
+            printf(" %9.2f", (double)latency->residency_sum[opcode][i] / count);
+        }
+        printf("\n");
+    }
+
+    for (opcode = 0; opcode < NUM_OPCODES; ++opcode)
+    {
+        if (!latency->count[opcode])
+        {
+            continue;
+        }
+
+        latency_print_histogram(opcode_names[opcode], "lifetime",
+                                latency->lifetime[opcode]);
+        for (i = 0; i < NUM_STAGES; ++i)
+        {
+            for (b = 0, buckets = 0; b < LATENCY_BUCKETS; ++b)
+            {
+                buckets += latency->residency[opcode][i][b] != 0;
+            }
+            if (buckets > 1)
+            {
+                latency_print_histogram(opcode_names[opcode], stage_names[i],
+                                        latency->residency[opcode][i]);
+            }
+        }
+    }
+}
+
+/* Starts recording hazard coverage, returns -1 if it can't be allocated */
+int
+APEX_stats_coverage_enable(APEX_CPU *cpu)
+{
+    if (!cpu->coverage)
+    {
+        cpu->coverage = calloc(1, sizeof(APEX_Coverage));
+    }
+    return cpu->coverage ? 0 : -1;
+}
+
+/*
+ * Prints how often decode read each operand of each opcode from the register
+ * file, from either forwarding path or stalled on it, for the opcodes that
+ * were decoded, then every combination of opcode, operand and source that
+ * never happened, including those of opcodes never decoded.
+ */
+void
+APEX_stats_coverage_print(const APEX_CPU *cpu)
+{
+    const APEX_Coverage *coverage = cpu->coverage;
+    int opcode, slot, source;
+    int combinations = 0, covered = 0;
+    long long reads;
+
+    if (!coverage)
+    {
+        return;
+    }
+
+    printf("APEX_COVERAGE: %-5s %-4s", "op", "slot");
+    for (source = 0; source < NUM_COVERAGE_SOURCES; ++source)
+    {
+        printf(" %12s", coverage_names[source]);
+    }
+    printf("\n");
+
+    for (opcode = 0; opcode < NUM_OPCODES; ++opcode)
+    {
+        for (slot = 0; slot < opcode_operands[opcode]; ++slot)
+        {
+            for (source = 0, reads = 0; source < NUM_COVERAGE_SOURCES; ++source)
+            {
+                reads += coverage->reads[opcode][slot][source];
+                combinations++;
+                covered += coverage->reads[opcode][slot][source] != 0;
+            }
+            if (!reads)
+            {
+                continue;
+            }
+
+            printf("APEX_COVERAGE: %-5s rs%-2d", opcode_names[opcode], slot + 1);
+            for (source = 0; source < NUM_COVERAGE_SOURCES; ++source)
+            {
+                printf(" %12lld", coverage->reads[opcode][slot][source]);
+            }
+            printf("\n");
+        }
+    }
+
+    printf("APEX_COVERAGE: %d of %d combinations covered (%.1f%%)\n", covered,
+           combinations, 100.0 * covered / combinations);
+    for (opcode = 0; opcode < NUM_OPCODES; ++opcode)
+    {
+        for (slot = 0; slot < opcode_operands[opcode]; ++slot)
+        {
+            for (source = 0; source < NUM_COVERAGE_SOURCES; ++source)
+            {
+                if (!coverage->reads[opcode][slot][source])
+                {
+                    printf("APEX_COVERAGE: uncovered %s rs%d %s\n",
+                           opcode_names[opcode], slot + 1,
+                           coverage_names[source]);
+                }
+            }
+        }
+    }
+}
+
+/* Sets the default cost table of the energy model */
+void
+APEX_stats_energy_defaults(APEX_Energy *energy)
+{
+    int i;
+
+    for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+    {
+        energy->cost[i] = energy_default_costs[i];
+    }
+    energy->frequency_mhz = ENERGY_DEFAULT_MHZ;
+}
+
+/*
+ * Reads "event pJ" lines from filename into the cost table, events being
+ * named as in the report, and "frequency_mhz <MHz>" for the clock. Events
+ * not in the file keep their cost. Returns -1 if the file can't be read or
+ * names an unknown event.
+ */
+int
+APEX_stats_energy_load(APEX_Energy *energy, const char *filename)
+{
+    char name[64];
+    double value;
+    FILE *fp;
+    int i;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    while (fscanf(fp, "%63s %lf", name, &value) == 2)
+    {
+        if (strcmp(name, "frequency_mhz") == 0 && value > 0)
+        {
+            energy->frequency_mhz = value;
+            continue;
+        }
+
+        for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+        {
+            if (strcmp(name, energy_names[i]) == 0)
+            {
+                energy->cost[i] = value;
+                break;
+            }
+        }
+        if (i == NUM_ENERGY_EVENTS)
+        {
+            fprintf(stderr, "APEX_Error: Unknown energy event %s in %s\n",
+                    name, filename);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Prints the energy of the run of cpu: the count of every event, taken from
+ * the performance counters, times its cost, then the total, the average
+ * power at the clock of the cost table and the energy delay product.
+ */
+void
+APEX_stats_energy_print(const APEX_CPU *cpu, const APEX_Energy *energy)
+{
+    const APEX_Stats *stats = &cpu->stats;
+    long long events[NUM_ENERGY_EVENTS] = {0};
+    long long retired;
+    double picojoules[NUM_ENERGY_EVENTS];
+    double total = 0.0;
+    double seconds;
+    int opcode, i;
+
+    for (opcode = 0; opcode < NUM_OPCODES; ++opcode)
+    {
+        retired = stats->retired[opcode];
+        events[ENERGY_REGFILE_READ] += opcode_operands[opcode] * retired;
+        switch (opcode)
+        {
+            case OPCODE_MUL:
+                events[ENERGY_MUL_OP] += retired;
+                break;
+
+            case OPCODE_DIV:
+                events[ENERGY_DIV_OP] += retired;
+                break;
+
+            case OPCODE_HALT:
+            case OPCODE_NOP:
+                break;
+
+            default:
+                /* Results, addresses and branch targets */
+                events[ENERGY_ALU_OP] += retired;
+                break;
+        }
+
+        switch (opcode)
+        {
+            case OPCODE_LOAD:
+            case OPCODE_LDR:
+            case OPCODE_STORE:
+            case OPCODE_STR:
+                events[ENERGY_MEMORY_ACCESS] += retired;
+                break;
+
+            default:
+                break;
+        }
+
+        if (opcode_writes[opcode])
+        {
+            events[ENERGY_REGFILE_WRITE] += retired;
+        }
+    }
+
+    /* Forwarded operands do not read the register file, and every stage but
+     * writeback writes the latch of the next one when it passes on */
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        events[ENERGY_REGFILE_READ] -= stats->forwards[i];
+        if (i != STAGE_WRITEBACK)
+        {
+            events[ENERGY_LATCH_WRITE] += stats->busy[i];
+        }
+    }
+    events[ENERGY_FLUSH] = stats->branch_flushes;
+    events[ENERGY_LEAKAGE] = cpu->clock;
+
+    printf("APEX_ENERGY: %-14s %12s %9s %14s %7s\n", "event", "count",
+           "pJ/event", "energy_nJ", "share");
+    for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+    {
+        picojoules[i] = events[i] * energy->cost[i];
+        total += picojoules[i];
+    }
+    for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+    {
+        printf("APEX_ENERGY: %-14s %12lld %9.3f %14.3f %6.2f%%\n",
+               energy_names[i], events[i], energy->cost[i],
+               picojoules[i] / 1e3, total ? 100.0 * picojoules[i] / total : 0.0);
+    }
+
+    seconds = cpu->clock / (energy->frequency_mhz * 1e6);
+    printf("APEX_ENERGY: total %.3f nJ, %.3f pJ per instruction\n",
+           total / 1e3, cpu->insn_completed ? total / cpu->insn_completed : 0.0);
+    printf("APEX_ENERGY: %d cycles at %.1f MHz = %.3f us, average power %.3f mW, EDP %.4e J*s\n",
+           cpu->clock, energy->frequency_mhz, seconds * 1e6,
+           seconds ? total * 1e-12 / seconds * 1e3 : 0.0,
+           total * 1e-12 * seconds);
+}
+
+/*
+ * Writes the performance counters of cpu to filename as JSON. Returns 0 on
+ * success.
+ */
+int
+APEX_stats_write_json(const APEX_CPU *cpu, const char *filename)
+{
+    const APEX_Stats *stats = &cpu->stats;
+    const char *sep;
+    FILE *fp;
+    int i, reg;
+
+    fp = fopen(filename, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"cycles\": %d,\n  \"instructions\": %d,\n  \"cpi\": %.4f,\n",
+            cpu->clock, cpu->insn_completed,
+            cpu->insn_completed ? (double)cpu->clock / cpu->insn_completed : 0.0);
+
+    fprintf(fp, "  \"stages\": {\n");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        fprintf(fp, "    \"%s\": {\"busy\": %lld, \"stalled\": %lld, \"empty\": %lld}%s\n",
+                stage_names[i], stats->busy[i], stats->stalled[i],
+                stats->empty[i], (i == NUM_STAGES - 1) ? "" : ",");
+    }
+    fprintf(fp, "  },\n");
+
+    /* RAW stalls by the stage holding the producer, then source register */
+    fprintf(fp, "  \"raw_stalls\": {\n");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        fprintf(fp, "    \"%s\": {", stage_names[i]);
+        sep = "";
+        for (reg = 0; reg < REG_FILE_SIZE; ++reg)
+        {
+            if (stats->raw_stalls[i][reg])
+            {
+                fprintf(fp, "%s\"R%d\": %lld", sep, reg, stats->raw_stalls[i][reg]);
+                sep = ", ";
+            }
+        }
+        fprintf(fp, "}%s\n", (i == NUM_STAGES - 1) ? "" : ",");
+    }
+    fprintf(fp, "  },\n");
+
+    fprintf(fp, "  \"forwarding\": {\"EX->D\": %lld, \"MEM->D\": %lld},\n",
+            stats->forwards[STAGE_EXECUTE], stats->forwards[STAGE_MEMORY]);
+    fprintf(fp, "  \"branch_flushes\": %lld,\n  \"squashed\": %lld,\n",
+            stats->branch_flushes, stats->squashed);
+
+    fprintf(fp, "  \"retired\": {");
+    for (i = 0; i < NUM_OPCODES; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %lld", i ? ", " : "", opcode_names[i],
+                stats->retired[i]);
+    }
+    fprintf(fp, "},\n");
+
+    /* Cycles by CPI stack category, they add up to cycles */
+    fprintf(fp, "  \"cpi_stack\": {");
+    for (i = 0; i < NUM_CPI; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %lld", i ? ", " : "", cpi_names[i],
+                stats->cpi_stack[i]);
+    }
+    fprintf(fp, "}\n}\n");
+
+    if (fclose(fp) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
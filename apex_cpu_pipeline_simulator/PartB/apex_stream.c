@@ -0,0 +1,305 @@
+/*
+ * apex_stream.c
+ * Contains decoupled simulation. The functional model runs on its own thread
+ * as the front end and produces a record for every executed instruction.
+ * The timing only pipeline is the back end and consumes a record for every
+ * instruction it executes, checking its pc and taking the branch outcome and
+ * data address from it. The two are connected by a lock-free single
+ * producer single consumer ring.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_stream.h"
+
+/* Keeps indices written by different threads on different cache lines */
+#define STREAM_CACHE_LINE 64
+
+typedef struct APEX_Stream
+{
+    APEX_Record records[STREAM_QUEUE_SIZE];
+
+    /* Written by the front end */
+    _Alignas(STREAM_CACHE_LINE) atomic_uint tail; /* Next slot to fill */
+    atomic_int done;               /* No more records will be added */
+    unsigned int cached_head;
+    long long full_waits;
+    APEX_CPU *func;
+    int func_status;
+
+    /* Written by the back end */
+    _Alignas(STREAM_CACHE_LINE) atomic_uint head; /* Next record to consume */
+    atomic_int abort;              /* The back end stopped with an error */
+    unsigned int cached_tail;
+    long long empty_waits;
+    long long consumed;
+} APEX_Stream;
+
+/* Returns the value of register reg, 0 if reg is not a register */
+static int
+stream_reg(const APEX_CPU *cpu, int reg)
+{
+    return (reg >= 0 && reg < REG_FILE_SIZE) ? cpu->regs[reg] : 0;
+}
+
+/*
+ * Executes the instruction at cpu->pc on the functional model and describes
+ * it in record. Returns the status of the functional model, record is only
+ * valid if it is not APEX_FUNC_ERROR.
+ */
+int
+APEX_stream_step(APEX_CPU *cpu, APEX_Record *record)
+{
+    const APEX_Instruction *ins;
+
+    if (cpu->pc < 4000 || (cpu->pc - 4000) % 4 != 0
+        || (cpu->pc - 4000) / 4 >= cpu->code_memory_size)
+    {
+        /* Let the functional model report the bad pc */
+        return APEX_func_step(cpu);
+    }
+
+    ins = &cpu->code_memory[(cpu->pc - 4000) / 4];
+    record->pc = cpu->pc;
+    record->opcode = ins->opcode;
+    record->memory_address = -1;
+    record->taken = -1;
+
+    switch (ins->opcode)
+    {
+        case OPCODE_LOAD:
+            record->memory_address = stream_reg(cpu, ins->rs1) + ins->imm;
+            break;
+
+        case OPCODE_LDR:
+            record->memory_address = stream_reg(cpu, ins->rs1)
+                                     + stream_reg(cpu, ins->rs2);
+            break;
+
+        case OPCODE_STORE:
+            record->memory_address = stream_reg(cpu, ins->rs2) + ins->imm;
+            break;
+
+        case OPCODE_STR:
+            record->memory_address = stream_reg(cpu, ins->rs2)
+                                     + stream_reg(cpu, ins->rs3);
+            break;
+
+        /* BZ and BNZ do not change the zero flag, so the outcome is known
+         * before the branch is executed */
+        case OPCODE_BZ:
+            record->taken = (cpu->zero_flag == TRUE);
+            break;
+
+        case OPCODE_BNZ:
+            record->taken = (cpu->zero_flag == FALSE);
+            break;
+
+        default:
+            break;
+    }
+    return APEX_func_step(cpu);
+}
+
+/* Front end thread: runs the functional model and adds its records */
+static void *
+stream_front_end(void *arg)
+{
+    APEX_Stream *stream = arg;
+    APEX_Record record;
+    unsigned int tail = 0;
+    int status = APEX_FUNC_OK;
+    long long start;
+
+    APEX_chrome_thread_name("front end");
+    start = APEX_chrome_begin();
+
+    while (status == APEX_FUNC_OK)
+    {
+        status = APEX_stream_step(stream->func, &record);
+        if (status == APEX_FUNC_ERROR)
+        {
+            break;
+        }
+
+        /* Wait for a free slot */
+        while (tail - stream->cached_head == STREAM_QUEUE_SIZE)
+        {
+            stream->cached_head = atomic_load_explicit(&stream->head,
+                                                       memory_order_acquire);
+            if (tail - stream->cached_head < STREAM_QUEUE_SIZE)
+            {
+                break;
+            }
+
+            if (atomic_load_explicit(&stream->abort, memory_order_relaxed))
+            {
+                stream->func_status = APEX_FUNC_ERROR;
+                APEX_chrome_end("stream_front_end", "simulate", start, "");
+                atomic_store_explicit(&stream->done, TRUE, memory_order_release);
+                return NULL;
+            }
+            stream->full_waits++;
+            sched_yield();
+        }
+
+        stream->records[tail & (STREAM_QUEUE_SIZE - 1)] = record;
+        atomic_store_explicit(&stream->tail, ++tail, memory_order_release);
+    }
+
+    stream->func_status = status;
+    APEX_chrome_end("stream_front_end", "simulate", start, "");
+    atomic_store_explicit(&stream->done, TRUE, memory_order_release);
+    return NULL;
+}
+
+/*
+ * Takes the next record off the stream into record. Returns FALSE once the
+ * front end is done and every record has been consumed.
+ */
+static int
+stream_pop(APEX_Stream *stream, APEX_Record *record)
+{
+    unsigned int head = atomic_load_explicit(&stream->head,
+                                             memory_order_relaxed);
+    int done;
+
+    while (head == stream->cached_tail)
+    {
+        /* done is set after the last record, so read it first */
+        done = atomic_load_explicit(&stream->done, memory_order_acquire);
+        stream->cached_tail = atomic_load_explicit(&stream->tail,
+                                                   memory_order_acquire);
+        if (head != stream->cached_tail)
+        {
+            break;
+        }
+
+        if (done)
+        {
+            return FALSE;
+        }
+        stream->empty_waits++;
+        sched_yield();
+    }
+
+    *record = stream->records[head & (STREAM_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&stream->head, head + 1, memory_order_release);
+    stream->consumed++;
+    return TRUE;
+}
+
+/*
+ * Record source of the back end. Records reach the pipeline's execute stage
+ * in program order, so the next record belongs to the instruction in
+ * execute.
+ */
+static int
+stream_next_record(void *source, const CPU_Stage *stage, int *memory_address)
+{
+    APEX_Stream *stream = source;
+    APEX_Record record;
+
+    if (!stream_pop(stream, &record))
+    {
+        fprintf(stderr, "APEX_Error: Stream has no more records at pc(%d)\n",
+                stage->pc);
+        return -1;
+    }
+
+    if (record.pc != stage->pc)
+    {
+        fprintf(stderr, "APEX_Error: Stream has pc(%d), pipeline executes pc(%d)\n",
+                record.pc, stage->pc);
+        return -1;
+    }
+
+    *memory_address = record.memory_address;
+    return record.taken > 0;
+}
+
+/*
+ * Simulates the whole program with the functional model and the timing only
+ * pipeline running on separate threads, and prints the final state. Returns
+ * 0 on success and 1 if the program did not complete.
+ */
+int
+APEX_cpu_decoupled(APEX_CPU *cpu)
+{
+    APEX_Stream *stream;
+    pthread_t front_end;
+    int status = APEX_CYCLE_OK, ret = 0;
+
+    stream = aligned_alloc(STREAM_CACHE_LINE,
+                           (sizeof(APEX_Stream) + STREAM_CACHE_LINE - 1)
+                           / STREAM_CACHE_LINE * STREAM_CACHE_LINE);
+    if (!stream)
+    {
+        return 1;
+    }
+    memset(stream, 0, sizeof(APEX_Stream));
+    atomic_init(&stream->tail, 0);
+    atomic_init(&stream->head, 0);
+    atomic_init(&stream->done, FALSE);
+    atomic_init(&stream->abort, FALSE);
+
+    stream->func = malloc(sizeof(APEX_CPU));
+    *stream->func = *cpu;
+
+    cpu->timing_only = TRUE;
+    cpu->debug_messages = FALSE;
+    cpu->next_record = stream_next_record;
+    cpu->record_source = stream;
+
+    if (pthread_create(&front_end, NULL, stream_front_end, stream) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to start the front end thread\n");
+        free(stream->func);
+        free(stream);
+        return 1;
+    }
+
+    while (status == APEX_CYCLE_OK)
+    {
+        status = APEX_cpu_cycle(cpu);
+    }
+
+    /* HALT consumed the last record, otherwise the front end may be waiting */
+    if (status != APEX_CYCLE_HALT)
+    {
+        atomic_store_explicit(&stream->abort, TRUE, memory_order_relaxed);
+    }
+    pthread_join(front_end, NULL);
+
+    if (status == APEX_CYCLE_HALT && stream->func_status == APEX_FUNC_HALT)
+    {
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+    }
+    else
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+        ret = 1;
+    }
+    APEX_stats_print_cpi_stack(cpu);
+    printf("APEX_STREAM: records = %lld front end waits = %lld back end waits = %lld\n",
+           stream->consumed, stream->full_waits, stream->empty_waits);
+
+    /* Architectural state comes from the functional model */
+    memcpy(cpu->regs, stream->func->regs, sizeof(cpu->regs));
+    memcpy(cpu->data_memory, stream->func->data_memory, sizeof(cpu->data_memory));
+    cpu->zero_flag = stream->func->zero_flag;
+    print_register_state(cpu);
+    print_data_memory(cpu);
+
+    free(stream->func);
+    free(stream);
+    return ret;
+}
@@ -0,0 +1,24 @@
+/*
+ * apex_stream.h
+ * Contains declarations of the executed instruction stream, which connects
+ * the functional model (front end) to the timing only pipeline (back end)
+ */
+#ifndef _APEX_STREAM_H_
+#define _APEX_STREAM_H_
+
+#include "apex_cpu.h"
+
+/* Records in flight between the front end and the back end, a power of 2 */
+#define STREAM_QUEUE_SIZE 4096
+
+/* An instruction executed by the functional model */
+typedef struct APEX_Record
+{
+    int pc;
+    int opcode;
+    int memory_address;            /* Data memory address, -1 if none */
+    int taken;                     /* Branch outcome, -1 if not a branch */
+} APEX_Record;
+
+int APEX_stream_step(APEX_CPU *cpu, APEX_Record *record);
+#endif
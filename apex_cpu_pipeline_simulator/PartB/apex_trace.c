@@ -0,0 +1,438 @@
+/*
+ * apex_trace.c
+ * Contains recording and replay of dynamic instruction traces. A trace holds
+ * the static code of the program followed by what the timing model needs
+ * from each executed instruction: one bit per branch outcome, and the data
+ * address of every load and store as a variable length delta from the last
+ * one. The executed pc sequence follows from the code and branch outcomes.
+ *
+ * Replay drives the timing only pipeline from a trace, without the
+ * functional model or the program's data: every executed branch takes the
+ * next outcome and every load and store the next data address. Traces are
+ * written in host byte order and read back through mmap.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_stream.h"
+
+#define TRACE_MAGIC "APEXTRC"
+#define TRACE_VERSION 1
+#define TRACE_OPCODE_LEN 16
+
+typedef struct APEX_Trace_Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t code_memory_size;
+    uint64_t num_records;          /* Executed instructions */
+    uint64_t num_branches;
+    uint64_t branch_bytes;
+    uint64_t address_bytes;
+    uint32_t end_status;           /* APEX_FUNC_HALT or APEX_FUNC_ERROR */
+    uint32_t reserved;
+} APEX_Trace_Header;
+
+/* Static instruction, code_memory_size of them follow the header */
+typedef struct APEX_Trace_Code
+{
+    int32_t opcode;
+    int32_t rd;
+    int32_t rs1;
+    int32_t rs2;
+    int32_t rs3;
+    int32_t imm;
+    char opcode_str[TRACE_OPCODE_LEN];
+} APEX_Trace_Code;
+
+/* Growable byte buffer */
+typedef struct APEX_Trace_Buffer
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} APEX_Trace_Buffer;
+
+/* Branch outcomes and data addresses being replayed */
+typedef struct APEX_Trace_Replay
+{
+    const unsigned char *bits;
+    uint64_t num_branches;
+    uint64_t next;
+    const unsigned char *addresses; /* Next address delta */
+    const unsigned char *addresses_end;
+    int last_address;
+} APEX_Trace_Replay;
+
+static void
+trace_put(APEX_Trace_Buffer *buffer, unsigned char byte)
+{
+    if (buffer->size == buffer->capacity)
+    {
+        buffer->capacity = buffer->capacity ? 2 * buffer->capacity : 4096;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    buffer->data[buffer->size++] = byte;
+}
+
+/* Appends value zigzag encoded, 7 bits per byte, low bits first */
+static void
+trace_put_varint(APEX_Trace_Buffer *buffer, int value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+    while (zigzag >= 0x80)
+    {
+        trace_put(buffer, (unsigned char)(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    trace_put(buffer, (unsigned char)zigzag);
+}
+
+/*
+ * Runs a copy of cpu through the functional model and writes its trace to
+ * filename. Returns 0 on success.
+ */
+int
+APEX_trace_record(const APEX_CPU *cpu, const char *filename)
+{
+    APEX_Trace_Header header;
+    APEX_Trace_Code code;
+    APEX_Trace_Buffer branches = {0}, addresses = {0};
+    APEX_Record record;
+    APEX_CPU *func;
+    int status = APEX_FUNC_OK, last_address = 0, i, ok;
+    FILE *fp;
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write trace %s\n", filename);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.code_memory_size = cpu->code_memory_size;
+
+    func = malloc(sizeof(APEX_CPU));
+    *func = *cpu;
+    while (status == APEX_FUNC_OK)
+    {
+        status = APEX_stream_step(func, &record);
+        if (status == APEX_FUNC_ERROR)
+        {
+            break;
+        }
+        header.num_records++;
+
+        if (record.taken >= 0)
+        {
+            if (header.num_branches % 8 == 0)
+            {
+                trace_put(&branches, 0);
+            }
+            branches.data[branches.size - 1]
+                |= record.taken << (header.num_branches % 8);
+            header.num_branches++;
+        }
+
+        if (record.memory_address >= 0)
+        {
+            trace_put_varint(&addresses, record.memory_address - last_address);
+            last_address = record.memory_address;
+        }
+    }
+    header.end_status = status;
+    header.branch_bytes = branches.size;
+    header.address_bytes = addresses.size;
+
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (i = 0; i < cpu->code_memory_size && ok; ++i)
+    {
+        memset(&code, 0, sizeof(code));
+        code.opcode = cpu->code_memory[i].opcode;
+        code.rd = cpu->code_memory[i].rd;
+        code.rs1 = cpu->code_memory[i].rs1;
+        code.rs2 = cpu->code_memory[i].rs2;
+        code.rs3 = cpu->code_memory[i].rs3;
+        code.imm = cpu->code_memory[i].imm;
+        strncpy(code.opcode_str, cpu->code_memory[i].opcode_str,
+                TRACE_OPCODE_LEN - 1);
+        ok = fwrite(&code, sizeof(code), 1, fp) == 1;
+    }
+    if (ok && branches.size)
+    {
+        ok = fwrite(branches.data, branches.size, 1, fp) == 1;
+    }
+    if (ok && addresses.size)
+    {
+        ok = fwrite(addresses.data, addresses.size, 1, fp) == 1;
+    }
+    if (fclose(fp) != 0 || !ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write trace %s\n", filename);
+        ok = FALSE;
+    }
+    else
+    {
+        printf("APEX_TRACE: Recorded %llu instructions, %llu branches, %llu bytes to %s\n",
+               (unsigned long long)header.num_records,
+               (unsigned long long)header.num_branches,
+               (unsigned long long)(sizeof(header)
+                                    + cpu->code_memory_size * sizeof(code)
+                                    + branches.size + addresses.size),
+               filename);
+    }
+
+    free(branches.data);
+    free(addresses.data);
+    free(func);
+    return ok ? 0 : -1;
+}
+
+/* Maps filename and checks that it is a complete trace */
+static const APEX_Trace_Header *
+trace_map(const char *filename, size_t *size)
+{
+    const APEX_Trace_Header *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(APEX_Trace_Header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    header = map;
+    *size = st.st_size;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if (header->version != TRACE_VERSION
+        || *size != sizeof(APEX_Trace_Header)
+                    + header->code_memory_size * sizeof(APEX_Trace_Code)
+                    + header->branch_bytes + header->address_bytes
+        || header->branch_bytes != (header->num_branches + 7) / 8)
+    {
+        fprintf(stderr, "APEX_Error: %s has an unsupported version or is corrupt\n",
+                filename);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    return header;
+}
+
+/* Returns TRUE if filename is an instruction trace rather than a program */
+int
+APEX_trace_is_trace(const char *filename)
+{
+    char magic[8];
+    FILE *fp;
+    int is_trace;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        return FALSE;
+    }
+    is_trace = fread(magic, sizeof(magic), 1, fp) == 1
+               && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return is_trace;
+}
+
+/*
+ * Creates an APEX cpu running the code stored in the trace filename.
+ * Returns NULL if the trace can not be read.
+ */
+APEX_CPU *
+APEX_trace_open(const char *filename)
+{
+    const APEX_Trace_Header *header;
+    const APEX_Trace_Code *code;
+    APEX_Instruction *code_memory;
+    size_t size;
+    uint32_t i;
+
+    header = trace_map(filename, &size);
+    if (!header)
+    {
+        return NULL;
+    }
+
+    code = (const APEX_Trace_Code *)(header + 1);
+    code_memory = calloc(header->code_memory_size ? header->code_memory_size : 1,
+                         sizeof(APEX_Instruction));
+    for (i = 0; i < header->code_memory_size; ++i)
+    {
+        code_memory[i].opcode = code[i].opcode;
+        code_memory[i].rd = code[i].rd;
+        code_memory[i].rs1 = code[i].rs1;
+        code_memory[i].rs2 = code[i].rs2;
+        code_memory[i].rs3 = code[i].rs3;
+        code_memory[i].imm = code[i].imm;
+        memcpy(code_memory[i].opcode_str, code[i].opcode_str,
+               TRACE_OPCODE_LEN - 1);
+    }
+
+    i = header->code_memory_size;
+    munmap((void *)header, size);
+    return APEX_cpu_init_code(code_memory, i);
+}
+
+/*
+ * Decodes the next address delta of replay into value. Returns FALSE if the
+ * trace has no more addresses.
+ */
+static int
+trace_get_varint(APEX_Trace_Replay *replay, int *value)
+{
+    uint32_t zigzag = 0;
+    int shift = 0;
+
+    do
+    {
+        if (replay->addresses == replay->addresses_end || shift > 28)
+        {
+            return FALSE;
+        }
+        zigzag |= (uint32_t)(*replay->addresses & 0x7f) << shift;
+        shift += 7;
+    } while (*replay->addresses++ & 0x80);
+
+    *value = (int)((zigzag >> 1) ^ (0u - (zigzag & 1)));
+    return TRUE;
+}
+
+/* Record source of the replaying cpu */
+static int
+trace_next_record(void *source, const CPU_Stage *stage, int *memory_address)
+{
+    APEX_Trace_Replay *replay = source;
+    int delta;
+    int taken;
+
+    *memory_address = -1;
+    switch (stage->opcode)
+    {
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        case OPCODE_STORE:
+        case OPCODE_STR:
+            if (!trace_get_varint(replay, &delta))
+            {
+                fprintf(stderr, "APEX_Error: Trace has no more data addresses at pc(%d)\n",
+                        stage->pc);
+                return -1;
+            }
+            replay->last_address += delta;
+            *memory_address = replay->last_address;
+            return 0;
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+            break;
+
+        default:
+            return 0;
+    }
+
+    if (replay->next == replay->num_branches)
+    {
+        fprintf(stderr, "APEX_Error: Trace has no more branches at pc(%d)\n",
+                stage->pc);
+        return -1;
+    }
+
+    taken = (replay->bits[replay->next / 8] >> (replay->next % 8)) & 1;
+    replay->next++;
+    return taken;
+}
+
+/*
+ * Simulates the timing of the trace filename on cpu, which must have been
+ * created from it by APEX_trace_open. Returns 0 if the whole trace was
+ * replayed.
+ */
+int
+APEX_cpu_replay(APEX_CPU *cpu, const char *filename)
+{
+    const APEX_Trace_Header *header;
+    APEX_Trace_Replay replay;
+    size_t size;
+    int status = APEX_CYCLE_OK, ret = 0;
+
+    header = trace_map(filename, &size);
+    if (!header)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read trace %s\n", filename);
+        return 1;
+    }
+
+    replay.bits = (const unsigned char *)header + sizeof(APEX_Trace_Header)
+                  + header->code_memory_size * sizeof(APEX_Trace_Code);
+    replay.num_branches = header->num_branches;
+    replay.next = 0;
+    replay.addresses = replay.bits + header->branch_bytes;
+    replay.addresses_end = replay.addresses + header->address_bytes;
+    replay.last_address = 0;
+
+    cpu->timing_only = TRUE;
+    cpu->debug_messages = FALSE;
+    cpu->next_record = trace_next_record;
+    cpu->record_source = &replay;
+
+    while (status == APEX_CYCLE_OK)
+    {
+        status = APEX_cpu_cycle(cpu);
+    }
+
+    if (status == APEX_CYCLE_HALT && header->end_status == APEX_FUNC_HALT
+        && (uint64_t)cpu->insn_completed == header->num_records)
+    {
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+    }
+    else
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n",
+               cpu->clock, cpu->insn_completed);
+        ret = 1;
+    }
+    APEX_stats_print_cpi_stack(cpu);
+    printf("APEX_TRACE: Replayed %llu of %llu branches, trace has %llu instructions\n",
+           (unsigned long long)replay.next,
+           (unsigned long long)header->num_branches,
+           (unsigned long long)header->num_records);
+
+    munmap((void *)header, size);
+    return ret;
+}
@@ -347,6 +347,81 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
     /* Fill in rest of the instructions accordingly */
 }
 
+/*
+ * Writes ins back in the assembly syntax of the input file, e.g.
+ * "LOAD R5,R2,#0", to buffer of size bytes.
+ */
+void
+format_instruction(const APEX_Instruction *ins, char *buffer, int size)
+{
+    switch (ins->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_LDR:
+        {
+            snprintf(buffer, size, "%s R%d,R%d,R%d", ins->opcode_str, ins->rd,
+                     ins->rs1, ins->rs2);
+            break;
+        }
+
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+        {
+            snprintf(buffer, size, "%s R%d,R%d,#%d", ins->opcode_str, ins->rd,
+                     ins->rs1, ins->imm);
+            break;
+        }
+
+        case OPCODE_MOVC:
+        {
+            snprintf(buffer, size, "%s R%d,#%d", ins->opcode_str, ins->rd,
+                     ins->imm);
+            break;
+        }
+
+        case OPCODE_STORE:
+        {
+            snprintf(buffer, size, "%s R%d,R%d,#%d", ins->opcode_str, ins->rs1,
+                     ins->rs2, ins->imm);
+            break;
+        }
+
+        case OPCODE_STR:
+        {
+            snprintf(buffer, size, "%s R%d,R%d,R%d", ins->opcode_str, ins->rs1,
+                     ins->rs2, ins->rs3);
+            break;
+        }
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        {
+            snprintf(buffer, size, "%s #%d", ins->opcode_str, ins->imm);
+            break;
+        }
+
+        case OPCODE_CMP:
+        {
+            snprintf(buffer, size, "%s R%d,R%d", ins->opcode_str, ins->rs1,
+                     ins->rs2);
+            break;
+        }
+
+        default:
+        {
+            snprintf(buffer, size, "%s", ins->opcode_str);
+            break;
+        }
+    }
+}
+
 /*
  * This function is related to parsing input file
  *
@@ -403,3 +478,32 @@ create_code_memory(const char *filename, int *size)
     fclose(fp);
     return code_memory;
 }
+
+/*
+ * Initializes data memory from a file with one "address value" pair per
+ * line. Returns the number of words set, or -1 if the file can't be read.
+ */
+int
+load_data_memory(const char *filename, int *data_memory)
+{
+    FILE *fp;
+    int address, value, count = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    while (fscanf(fp, "%d %d", &address, &value) == 2)
+    {
+        if (address >= 0 && address < DATA_MEMORY_SIZE)
+        {
+            data_memory[address] = value;
+            count++;
+        }
+    }
+
+    fclose(fp);
+    return count;
+}
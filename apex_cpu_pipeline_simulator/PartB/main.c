@@ -11,57 +11,734 @@
 #include <string.h>
 
 
+#include "apex_cfg.h"
 #include "apex_cpu.h"
 
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s <input_file> [simulate <cycles> | display <cycles> | functional | memo | decoupled | simpoint | smarts | record <trace_file> | aot] [options]\n", prog);
+    fprintf(stderr, "APEX_Help: Usage %s <trace_file> [replay]\n", prog);
+    fprintf(stderr, "APEX_Help: Options:\n");
+    fprintf(stderr, "  --jit           run the functional model through the x86-64 JIT\n");
+    fprintf(stderr, "  --jit-verify    check the JIT against the interpreter in lock-step\n");
+    fprintf(stderr, "  --memo-check    compare memoized timing against the full simulation\n");
+    fprintf(stderr, "  --interval <n>  instructions per interval, 1000 for simpoint, sampling period 10000 for smarts\n");
+    fprintf(stderr, "  --warmup <n>    instructions simulated before each sampled interval (default 200)\n");
+    fprintf(stderr, "  --window <n>    instructions measured per smarts sample (default 100)\n");
+    fprintf(stderr, "  --target-error <e>  relative CPI error smarts sizes the sample for (default 0.03)\n");
+    fprintf(stderr, "  --max-k <k>     most SimPoint clusters to consider (default 10)\n");
+    fprintf(stderr, "  --bbv <file>    write the basic block vectors of each interval\n");
+    fprintf(stderr, "  --threads <n>   simulate sampled intervals on <n> threads (default 1)\n");
+    fprintf(stderr, "  --sample-check  also run the full simulation and report the sampling error\n");
+    fprintf(stderr, "  --data <file>   initialize data memory from \"address value\" lines\n");
+    fprintf(stderr, "  --cfg <file>    write the control flow graph, as DOT if <file> ends in .dot else JSON\n");
+    fprintf(stderr, "  --stats <file>  write pipeline performance counters as JSON at exit\n");
+    fprintf(stderr, "  --profile       print the program listing annotated with per instruction costs\n");
+    fprintf(stderr, "  --callgrind <file>  write per instruction and basic block costs for KCachegrind\n");
+    fprintf(stderr, "  --intervals <file>  write IPC and stall breakdown per interval as CSV\n");
+    fprintf(stderr, "  --interval-cycles <n>  cycles per interval row (default 10000)\n");
+    fprintf(stderr, "  --konata <file>  write a pipeline trace for the Konata viewer\n");
+    fprintf(stderr, "  --mrc <file>    write LRU miss ratio curves of data memory accesses as CSV\n");
+    fprintf(stderr, "  --bpred         evaluate a bank of branch predictors on the BZ/BNZ outcomes\n");
+    fprintf(stderr, "  --coverage      print which forwarding paths and stalls decode exercised, per opcode and operand\n");
+    fprintf(stderr, "  --energy        print the energy, average power and EDP of the run\n");
+    fprintf(stderr, "  --energy-costs <file>  \"event pJ\" and \"frequency_mhz MHz\" lines of the energy model, implies --energy\n");
+    fprintf(stderr, "  --critical-path  print the dataflow critical path against the actual cycles\n");
+    fprintf(stderr, "  --latency       print fetch to retire and per stage latency histograms by opcode\n");
+    fprintf(stderr, "  --chrome-trace <file>  write host time spans as Chrome trace events for Perfetto\n");
+    fprintf(stderr, "  --metrics-port <port>  serve live metrics for Prometheus on 127.0.0.1:<port>, 0 for any free port\n");
+    fprintf(stderr, "  --checkpoint-at <cycle>  save a checkpoint after <cycle> and stop\n");
+    fprintf(stderr, "  --checkpoint <file>      checkpoint file, default <input_file>.ckpt, also saved on quit\n");
+    fprintf(stderr, "  --resume <file>          continue from a checkpoint\n");
+}
+
+/* Reports written at the end of a pipeline run */
+typedef struct APEX_Reports
+{
+    const char *stats_file;
+    const char *callgrind_file;
+    const char *interval_file;
+    const char *konata_file;
+    const char *mrc_file;
+    const char *source;            /* Program or trace the cpu was loaded from */
+    int profile;
+    int latency;
+    int coverage;
+    int energy_report;
+    APEX_Energy energy;            /* Cost table of energy_report */
+    int critical_path;
+    int bpred;
+    int interval_cycles;           /* Cycles per row of interval_file */
+    int metrics_port;              /* -1 for no metrics endpoint */
+} APEX_Reports;
+
+/* Returns TRUE if the reports need the per instruction profile */
+static int
+needs_profile(const APEX_Reports *reports)
+{
+    return reports->profile || reports->callgrind_file;
+}
+
+/* Returns the first report option given, NULL if there is none */
+static const char *
+report_option(const APEX_Reports *reports)
+{
+    if (reports->stats_file)
+    {
+        return "--stats";
+    }
+    if (reports->profile)
+    {
+        return "--profile";
+    }
+    if (reports->callgrind_file)
+    {
+        return "--callgrind";
+    }
+    if (reports->interval_file)
+    {
+        return "--intervals";
+    }
+    if (reports->konata_file)
+    {
+        return "--konata";
+    }
+    if (reports->mrc_file)
+    {
+        return "--mrc";
+    }
+    if (reports->bpred)
+    {
+        return "--bpred";
+    }
+    if (reports->coverage)
+    {
+        return "--coverage";
+    }
+    if (reports->energy_report)
+    {
+        return "--energy";
+    }
+    if (reports->critical_path)
+    {
+        return "--critical-path";
+    }
+    if (reports->latency)
+    {
+        return "--latency";
+    }
+    if (reports->metrics_port >= 0)
+    {
+        return "--metrics-port";
+    }
+    return NULL;
+}
+
+/* Returns TRUE for the commands that do not run the pipeline with reports */
+static int
+ignores_reports(const char *function_name)
+{
+    static const char *const names[] = {
+        "functional", "memo", "simpoint", "smarts", "aot", "record"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (strcmp(function_name, names[i]) == 0)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Returns the first checkpoint option given, NULL if there is none */
+static const char *
+checkpoint_option(int checkpoint_at, const char *checkpoint_file,
+                  const char *resume_file)
+{
+    if (resume_file)
+    {
+        return "--resume";
+    }
+    if (checkpoint_at > 0)
+    {
+        return "--checkpoint-at";
+    }
+    if (checkpoint_file)
+    {
+        return "--checkpoint";
+    }
+    return NULL;
+}
+
+/* Returns TRUE for the commands that do not run the pipeline from the fetch
+ * pc and latches a checkpoint holds */
+static int
+ignores_checkpoints(const char *function_name)
+{
+    return ignores_reports(function_name)
+           || strcmp(function_name, "decoupled") == 0;
+}
+
+/* Starts collecting what the reports need, right before a pipeline run */
+static void
+start_reports(APEX_CPU *cpu, const APEX_Reports *reports)
+{
+    int port;
+
+    if (needs_profile(reports) && APEX_profile_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the profile\n");
+        exit(1);
+    }
+
+    if (reports->latency && APEX_stats_latency_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the latency histograms\n");
+        exit(1);
+    }
+
+    if (reports->coverage && APEX_stats_coverage_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the hazard coverage\n");
+        exit(1);
+    }
+
+    if (reports->critical_path && APEX_critical_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the critical path analysis\n");
+        exit(1);
+    }
+
+    if (reports->mrc_file && APEX_mrc_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the miss ratio curves\n");
+        exit(1);
+    }
+
+    if (reports->bpred && APEX_bpred_enable(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the branch predictors\n");
+        exit(1);
+    }
+
+    if (reports->interval_file
+        && APEX_stats_intervals_open(cpu, reports->interval_file,
+                                     reports->interval_cycles) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write intervals to %s\n",
+                reports->interval_file);
+        exit(1);
+    }
+
+    if (reports->konata_file
+        && APEX_konata_open(cpu, reports->konata_file) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write pipeline trace to %s\n",
+                reports->konata_file);
+        exit(1);
+    }
+
+    if (reports->metrics_port >= 0)
+    {
+        port = APEX_metrics_start(cpu, reports->metrics_port);
+        if (port < 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to serve metrics on port %d\n",
+                    reports->metrics_port);
+            exit(1);
+        }
+        fprintf(stderr, "APEX_METRICS: Serving http://127.0.0.1:%d/metrics\n",
+                port);
+    }
+
+    /* Simulated cycles are traced in chunks */
+    cpu->chrome_chunk_start = APEX_chrome_begin();
+    cpu->chrome_chunk_clock = cpu->clock;
+}
+
+/* Writes the reports that were asked for */
+static void
+write_reports(APEX_CPU *cpu, const APEX_Reports *reports)
+{
+    long long start;
+
+    if (cpu->chrome_chunk_start)
+    {
+        APEX_chrome_chunk(cpu);
+        cpu->chrome_chunk_start = 0;
+    }
+
+    if (cpu->next_metrics)
+    {
+        APEX_metrics_publish(cpu, FALSE);
+    }
+
+    start = APEX_chrome_begin();
+    if (reports->interval_file && APEX_stats_intervals_close(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write intervals to %s\n",
+                reports->interval_file);
+    }
+
+    if (reports->konata_file && APEX_konata_close(cpu) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write pipeline trace to %s\n",
+                reports->konata_file);
+    }
+
+    if (reports->stats_file
+        && APEX_stats_write_json(cpu, reports->stats_file) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write stats to %s\n",
+                reports->stats_file);
+    }
+
+    if (reports->mrc_file && APEX_mrc_write(cpu, reports->mrc_file) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write miss ratio curves to %s\n",
+                reports->mrc_file);
+    }
+
+    if (reports->callgrind_file
+        && APEX_profile_write_callgrind(cpu, reports->source,
+                                        reports->callgrind_file) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write callgrind profile to %s\n",
+                reports->callgrind_file);
+    }
+
+    if (reports->profile)
+    {
+        APEX_profile_print(cpu);
+    }
+
+    if (reports->latency)
+    {
+        APEX_stats_latency_print(cpu);
+    }
+
+    if (reports->coverage)
+    {
+        APEX_stats_coverage_print(cpu);
+    }
+
+    if (reports->critical_path)
+    {
+        APEX_critical_print(cpu);
+    }
+
+    if (reports->bpred)
+    {
+        APEX_bpred_print(cpu);
+    }
+
+    if (reports->energy_report)
+    {
+        APEX_stats_energy_print(cpu, &reports->energy);
+    }
+    APEX_chrome_end("write_reports", "output", start, "");
+}
+
+/* Finishes the Chrome trace when the simulator exits */
+static void
+close_chrome_trace(void)
+{
+    if (APEX_chrome_close() < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write Chrome trace\n");
+    }
+}
+
 int
 main(int argc, char const *argv[])
 {
     APEX_CPU *cpu;
+    const char *args[3];
+    int num_args = 0;
+    int use_jit = FALSE;
+    int jit_verify = FALSE;
+    int memo_check = FALSE;
+    int interval = 0;
+    int warmup = 200;
+    int window = 100;
+    double target_error = 0.03;
+    int max_k = 10;
+    int sample_check = FALSE;
+    int threads = 1;
+    const char *bbv_file = NULL;
+    const char *data_file = NULL;
+    const char *cfg_file = NULL;
+    APEX_Reports reports = {.interval_cycles = 10000, .metrics_port = -1};
+    const char *checkpoint_file = NULL;
+    const char *resume_file = NULL;
+    const char *chrome_file = NULL;
+    char default_checkpoint[1024];
+    long long start;
+    int checkpoint_at = 0;
+    int is_trace;
+    int i;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
+    APEX_stats_energy_defaults(&reports.energy);
 
-    if (argc < 2 || argc > 4)
+    /* Options start with "--", everything else is positional */
+    for (i = 1; i < argc; ++i)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        if (strcmp(argv[i], "--jit") == 0)
+        {
+            use_jit = TRUE;
+        }
+        else if (strcmp(argv[i], "--jit-verify") == 0)
+        {
+            use_jit = TRUE;
+            jit_verify = TRUE;
+        }
+        else if (strcmp(argv[i], "--memo-check") == 0)
+        {
+            memo_check = TRUE;
+        }
+        else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+        {
+            interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+        {
+            warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+        {
+            window = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--target-error") == 0 && i + 1 < argc)
+        {
+            target_error = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-k") == 0 && i + 1 < argc)
+        {
+            max_k = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bbv") == 0 && i + 1 < argc)
+        {
+            bbv_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--sample-check") == 0)
+        {
+            sample_check = TRUE;
+        }
+        else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+        {
+            data_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cfg") == 0 && i + 1 < argc)
+        {
+            cfg_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+        {
+            reports.stats_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            reports.profile = TRUE;
+        }
+        else if (strcmp(argv[i], "--callgrind") == 0 && i + 1 < argc)
+        {
+            reports.callgrind_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--intervals") == 0 && i + 1 < argc)
+        {
+            reports.interval_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--interval-cycles") == 0 && i + 1 < argc)
+        {
+            reports.interval_cycles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mrc") == 0 && i + 1 < argc)
+        {
+            reports.mrc_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bpred") == 0)
+        {
+            reports.bpred = TRUE;
+        }
+        else if (strcmp(argv[i], "--energy") == 0)
+        {
+            reports.energy_report = TRUE;
+        }
+        else if (strcmp(argv[i], "--energy-costs") == 0 && i + 1 < argc)
+        {
+            reports.energy_report = TRUE;
+            if (APEX_stats_energy_load(&reports.energy, argv[++i]) < 0)
+            {
+                fprintf(stderr, "APEX_Error: Unable to read energy costs from %s\n",
+                        argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--coverage") == 0)
+        {
+            reports.coverage = TRUE;
+        }
+        else if (strcmp(argv[i], "--critical-path") == 0)
+        {
+            reports.critical_path = TRUE;
+        }
+        else if (strcmp(argv[i], "--latency") == 0)
+        {
+            reports.latency = TRUE;
+        }
+        else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc)
+        {
+            reports.metrics_port = atoi(argv[++i]);
+            if (reports.metrics_port < 0 || reports.metrics_port > 65535)
+            {
+                fprintf(stderr, "APEX_Error: Invalid metrics port %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--konata") == 0 && i + 1 < argc)
+        {
+            reports.konata_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--chrome-trace") == 0 && i + 1 < argc)
+        {
+            chrome_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-at") == 0 && i + 1 < argc)
+        {
+            checkpoint_at = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            checkpoint_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            resume_file = argv[++i];
+        }
+        else if (strncmp(argv[i], "--", 2) == 0 || num_args == 3)
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+        else
+        {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 1)
+    {
+        print_usage(argv[0]);
         exit(1);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
-    if(argc > 2)
+    if (num_args > 1 && ignores_reports(args[1]) && report_option(&reports))
     {
-      const char* function_name = argv[2];
+        fprintf(stderr, "APEX_Error: %s is not supported with %s\n",
+                report_option(&reports), args[1]);
+        exit(1);
+    }
+
+    is_trace = APEX_trace_is_trace(args[0]);
+    if ((is_trace || (num_args > 1 && ignores_checkpoints(args[1])))
+        && checkpoint_option(checkpoint_at, checkpoint_file, resume_file))
+    {
+        fprintf(stderr, "APEX_Error: %s is not supported with %s\n",
+                checkpoint_option(checkpoint_at, checkpoint_file, resume_file),
+                is_trace ? "replay" : args[1]);
+        exit(1);
+    }
+
+    /* A trace holds neither the program's data nor a CFG to export */
+    if (is_trace && (data_file || cfg_file))
+    {
+        fprintf(stderr, "APEX_Error: %s is not supported with replay\n",
+                data_file ? "--data" : "--cfg");
+        exit(1);
+    }
+
+    reports.source = args[0];
+    if (chrome_file)
+    {
+        if (APEX_chrome_open(chrome_file, args[0]) < 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to write Chrome trace to %s\n",
+                    chrome_file);
+            exit(1);
+        }
+        atexit(close_chrome_trace);
+    }
+
+    /* A recorded trace only drives the timing of the pipeline */
+    if (is_trace)
+    {
+        if (num_args > 1 && strcmp(args[1], "replay") != 0)
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+
+        start = APEX_chrome_begin();
+        cpu = APEX_trace_open(args[0]);
+        APEX_chrome_end("APEX_trace_open", "load", start, "");
+        if (!cpu)
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
+            exit(1);
+        }
+
+        start_reports(cpu, &reports);
+        i = APEX_cpu_replay(cpu, args[0]);
+        write_reports(cpu, &reports);
+        APEX_cpu_stop(cpu);
+        return i;
+    }
+
+    cpu = APEX_cpu_init(args[0]);
+    if (!cpu)
+    {
+        fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
+        exit(1);
+    }
+
+    if (data_file && load_data_memory(data_file, cpu->data_memory) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read data file %s\n", data_file);
+        exit(1);
+    }
+
+    if (cfg_file
+        && APEX_cfg_export(cpu->cfg, cpu->code_memory, cfg_file) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write CFG to %s\n", cfg_file);
+        exit(1);
+    }
+
+    if (resume_file)
+    {
+        start = APEX_chrome_begin();
+        i = APEX_cpu_checkpoint_load(cpu, resume_file);
+        APEX_chrome_end("APEX_cpu_checkpoint_load", "checkpoint", start, "");
+        if (i < 0)
+        {
+            exit(1);
+        }
+    }
+
+    if (checkpoint_at > 0 && !checkpoint_file)
+    {
+        snprintf(default_checkpoint, sizeof(default_checkpoint), "%s.ckpt",
+                 args[0]);
+        checkpoint_file = default_checkpoint;
+    }
+    cpu->checkpoint_at = checkpoint_at;
+    cpu->checkpoint_file = checkpoint_file;
+
+    if(num_args > 1)
+    {
+      const char* function_name = args[1];
       //printf("%s\n",function_name);
       //function_name = tolower(function_name);
-      printf("%s\n",function_name);
-      printf("cycles=%s\n",argv[3]);
-      int cycles = atoi(argv[3]);
-      if (!cpu)
+
+      if(strcmp(function_name, "functional") == 0)
       {
-          fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
-          exit(1);
+        int ret = APEX_cpu_functional(cpu, use_jit, jit_verify);
+        APEX_cpu_stop(cpu);
+        return ret;
       }
 
-      if(argc == 4)
+      if(strcmp(function_name, "memo") == 0)
       {
+        int ret = APEX_cpu_memo(cpu, memo_check);
+        APEX_cpu_stop(cpu);
+        return ret;
+      }
+
+      if(strcmp(function_name, "decoupled") == 0)
+      {
+        int ret;
+
+        start_reports(cpu, &reports);
+        ret = APEX_cpu_decoupled(cpu);
+        write_reports(cpu, &reports);
+        APEX_cpu_stop(cpu);
+        return ret;
+      }
+
+      if(strcmp(function_name, "simpoint") == 0)
+      {
+        int ret = APEX_cpu_simpoint(cpu, interval ? interval : 1000, warmup,
+                                    max_k, bbv_file, sample_check, threads);
+        APEX_cpu_stop(cpu);
+        return ret;
+      }
+
+      if(strcmp(function_name, "smarts") == 0)
+      {
+        int ret = APEX_cpu_smarts(cpu, interval ? interval : 10000, warmup,
+                                  window, target_error, sample_check,
+                                  threads);
+        APEX_cpu_stop(cpu);
+        return ret;
+      }
+
+      if(strcmp(function_name, "aot") == 0)
+      {
+        int ret = APEX_cpu_aot(cpu, args[0], data_file);
+        APEX_cpu_stop(cpu);
+        return ret == 0 ? 0 : 1;
+      }
+
+      printf("%s\n",function_name);
+      if(num_args == 3)
+      {
+        if(strcmp(function_name, "record") == 0)
+        {
+          int ret = APEX_trace_record(cpu, args[2]);
+          APEX_cpu_stop(cpu);
+          return ret == 0 ? 0 : 1;
+        }
+
+        printf("cycles=%s\n",args[2]);
+        int cycles = atoi(args[2]);
         if(strcmp(function_name, "simulate") == 0)
         {
           printf("Inside simulate and cycles = %d\n",cycles);
+            start_reports(cpu, &reports);
             APEX_cpu_simulate(cpu,cycles);
+            write_reports(cpu, &reports);
             APEX_cpu_stop(cpu);
             return 0;
         }
 
         if(strcmp(function_name, "display") == 0)
         {
+          start_reports(cpu, &reports);
           APEX_cpu_display(cpu);
+          write_reports(cpu, &reports);
           APEX_cpu_stop(cpu);
           return 0;
         }
       }
+
+      print_usage(argv[0]);
+      APEX_cpu_stop(cpu);
+      return 1;
     }
     else
     {
+      start_reports(cpu, &reports);
       APEX_cpu_run(cpu);
+      write_reports(cpu, &reports);
       APEX_cpu_stop(cpu);
       return 0;
     }